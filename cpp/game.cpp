@@ -13,6 +13,77 @@
 #include <flame/universe/components/camera.h>
 #include <flame/universe/components/body2d.h>
 #include <flame/universe/systems/scene.h>
+#include <flame/universe/systems/tween.h>
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+bool headless = false;
+float fixed_step = 1.f / 60.f;
+
+enum Phase
+{
+	PhaseUnits,
+	PhaseBullets,
+	PhaseContacts,
+	PhaseEconomy,
+	PhaseAI,
+	PhaseBorders,
+	PhaseCount
+};
+
+const char* phase_names[PhaseCount] = { "unit_update", "bullet_update", "contacts", "city_economy", "ai", "border_rebuild" };
+
+bool profiling = false;
+float phase_times[PhaseCount] = {}; // seconds spent in each phase during the current frame
+bool phase_active[PhaseCount] = {};
+
+struct PhaseScope;
+PhaseScope* phase_top = nullptr;
+
+// accumulates into phase_times, nested scopes of the same phase are only counted once,
+// a nested scope of another phase pauses the outer one so every phase is timed exclusively
+struct PhaseScope
+{
+	Phase phase;
+	bool owner = false;
+	PhaseScope* parent = nullptr;
+	std::chrono::high_resolution_clock::time_point t0;
+
+	PhaseScope(Phase _phase) :
+		phase(_phase)
+	{
+		if (profiling && !phase_active[phase])
+		{
+			owner = true;
+			phase_active[phase] = true;
+			t0 = std::chrono::high_resolution_clock::now();
+			parent = phase_top;
+			if (parent)
+				phase_times[parent->phase] += std::chrono::duration<float>(t0 - parent->t0).count();
+			phase_top = this;
+		}
+	}
+
+	~PhaseScope()
+	{
+		if (owner)
+		{
+			auto now = std::chrono::high_resolution_clock::now();
+			phase_times[phase] += std::chrono::duration<float>(now - t0).count();
+			phase_active[phase] = false;
+			phase_top = parent;
+			if (parent)
+				parent->t0 = now;
+		}
+	}
+};
+
+struct Tile;
 
 struct Game : UniverseApplication
 {
@@ -20,6 +91,12 @@ struct Game : UniverseApplication
 	graphics::CanvasPtr ui_canvas = nullptr;
 
 	void init();
+	float step_headless(uint frames);
+	void run_headless(uint frames);
+	void run_benchmark(uint frames, const std::string& out_path);
+	vec2 screen_to_world(const vec2& screen_pos);
+	void camera_view_rect(vec2& lt, vec2& rb, float margin);
+	Tile* pick_tile(const vec2& screen_pos);
 	bool on_update() override;
 	void on_hud() override;
 };
@@ -58,8 +135,86 @@ audio::SourcePtr sound_construction_end = nullptr;
 audio::SourcePtr sound_shot = nullptr;
 audio::SourcePtr sound_hit = nullptr;
 
+inline graphics::ImagePtr load_image(const std::filesystem::path& path)
+{
+	if (headless)
+		return nullptr;
+	return graphics::Image::get(path);
+}
+
+// art that the first frame doesn't need (tech icons, building and unit images) is loaded on first use
+struct LazyImage
+{
+	std::filesystem::path path;
+	graphics::ImagePtr image = nullptr;
+	bool loaded = false;
+
+	graphics::ImagePtr get()
+	{
+		if (!loaded)
+		{
+			loaded = true;
+			if (!path.empty())
+				image = load_image(path);
+		}
+		return image;
+	}
+};
+
+// warms the OS file cache: the eagerly loaded asset files are read and discarded on background threads while
+// the window and device are created, so the engine's own loads on the main thread don't wait on the disk
+// this is not a loader, decoding and uploading still happen serially in Image::get / Buffer::get
+struct FileCachePrefetcher
+{
+	std::vector<std::filesystem::path> paths;
+	std::vector<std::thread> threads;
+	std::atomic<uint> next = 0;
+	std::atomic<uint> done = 0;
+
+	void start(std::vector<std::filesystem::path>&& _paths, uint n_threads)
+	{
+		paths = std::move(_paths);
+		n_threads = min(n_threads, (uint)paths.size());
+		for (auto i = 0; i < n_threads; i++)
+		{
+			threads.emplace_back([this]() {
+				char buf[64 * 1024];
+				uint idx;
+				while ((idx = next.fetch_add(1)) < paths.size())
+				{
+					std::ifstream file(paths[idx], std::ios::binary);
+					while (file.read(buf, sizeof(buf)))
+						;
+					done++;
+				}
+			});
+		}
+	}
+
+	void finish()
+	{
+		for (auto& t : threads)
+			t.join();
+		threads.clear();
+	}
+};
+FileCachePrefetcher file_prefetcher;
+
+std::chrono::steady_clock::time_point init_begin_time;
+float time_to_first_frame = 0.f;
+uint assets_loaded = 0;
+
+void report_load_progress(const char* stage, uint n)
+{
+	assets_loaded += n;
+	auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - init_begin_time).count();
+	printf("loading %s: %u/%u assets (%u files cached), %.0f ms\n", stage, assets_loaded, (uint)file_prefetcher.paths.size(), file_prefetcher.done.load(), ms);
+}
+
 inline audio::SourcePtr load_sound_effect(const std::filesystem::path& path, float volumn)
 {
+	if (headless)
+		return nullptr;
 	auto buf = audio::Buffer::get(path);
 	auto ret = audio::Source::create();
 	ret->add_buffer(buf);
@@ -68,6 +223,110 @@ inline audio::SourcePtr load_sound_effect(const std::filesystem::path& path, flo
 	return ret;
 }
 
+inline void play_sound(audio::SourcePtr sound)
+{
+	if (sound)
+		sound->play();
+}
+
+// gameplay sounds are posted as events and played once per frame in flush(): identical events of a frame are merged,
+// a sound is restarted at most 'max_voices' times per 'voice_time' and positional events outside the camera view are dropped
+struct AudioMixer
+{
+	struct Channel
+	{
+		audio::SourcePtr sound = nullptr;
+		uint max_voices = 1;
+		float voice_time = 0.1f;
+		std::vector<float> voice_starts;
+		uint pending = 0;
+	};
+
+	std::vector<Channel> channels;
+	bool has_view = false;
+	vec2 view_lt, view_rb;
+
+	uint events = 0;
+	uint played = 0;
+	uint merged = 0;
+	uint over_voices = 0;
+	uint culled = 0;
+
+	void add_channel(audio::SourcePtr sound, uint max_voices, float voice_time)
+	{
+		if (!sound)
+			return;
+		auto& ch = channels.emplace_back();
+		ch.sound = sound;
+		ch.max_voices = max_voices;
+		ch.voice_time = voice_time;
+	}
+
+	Channel* find_channel(audio::SourcePtr sound)
+	{
+		for (auto& ch : channels)
+		{
+			if (ch.sound == sound)
+				return &ch;
+		}
+		return nullptr;
+	}
+
+	void post(audio::SourcePtr sound)
+	{
+		if (!sound)
+			return;
+		events++;
+		if (auto ch = find_channel(sound); ch)
+			ch->pending++;
+		else
+		{
+			sound->play();
+			played++;
+		}
+	}
+
+	void post(audio::SourcePtr sound, const vec2& pos)
+	{
+		if (!sound)
+			return;
+		if (has_view && (pos.x < view_lt.x || pos.y < view_lt.y || pos.x > view_rb.x || pos.y > view_rb.y))
+		{
+			events++;
+			culled++;
+			return;
+		}
+		post(sound);
+	}
+
+	// the view is the one events of the next frame are culled against
+	void flush(float time, const vec2& lt, const vec2& rb)
+	{
+		for (auto& ch : channels)
+		{
+			if (!ch.pending)
+				continue;
+			merged += ch.pending - 1;
+			ch.pending = 0;
+			std::erase_if(ch.voice_starts, [&](float t) {
+				return time - t >= ch.voice_time;
+			});
+			if (ch.voice_starts.size() >= ch.max_voices)
+			{
+				over_voices++;
+				continue;
+			}
+			ch.voice_starts.push_back(time);
+			ch.sound->play();
+			played++;
+		}
+		has_view = true;
+		view_lt = lt;
+		view_rb = rb;
+	}
+};
+AudioMixer audio_mixer;
+
 enum ElementType
 {
 	ElementNone = -1,
@@ -123,6 +382,43 @@ const wchar_t ch_icon_population = graphics::CH_ICON_BEGIN + 2;
 const wchar_t ch_icon_production = graphics::CH_ICON_BEGIN + 3;
 const wchar_t ch_icon_science = graphics::CH_ICON_BEGIN + 4;
 
+// formatted hud strings, keyed by owner and format, an entry is formatted again only when its values change
+struct HudTextCache
+{
+	struct Entry
+	{
+		const void* owner = nullptr;
+		const wchar_t* fmt = nullptr;
+		uint64_t key = 0;
+		std::wstring text;
+	};
+
+	std::unordered_map<uint64_t, Entry> entries;
+	uint formatted = 0;
+
+	template<typename... Args>
+	const std::wstring& get(const void* owner, std::wformat_string<Args...> fmt, Args&&... args)
+	{
+		auto fmt_ptr = fmt.get().data();
+		auto key = 0xcbf29ce484222325ULL;
+		((key = (key ^ std::hash<std::decay_t<Args>>()(args)) * 0x100000001b3ULL), ...);
+
+		if (entries.size() > 4096)
+			entries.clear();
+		auto& e = entries[std::hash<const void*>()(owner) * 31 + std::hash<const void*>()(fmt_ptr)];
+		if (e.owner != owner || e.fmt != fmt_ptr || e.key != key || e.text.empty())
+		{
+			e.owner = owner;
+			e.fmt = fmt_ptr;
+			e.key = key;
+			e.text = std::format(fmt, std::forward<Args>(args)...);
+			formatted++;
+		}
+		return e.text;
+	}
+};
+HudTextCache hud_texts;
+
 enum BuildingType
 {
 	BuildingConstruction,
@@ -141,18 +437,26 @@ enum BuildingType
 	BuildingTypeCount
 };
 
+// keys of the built-in types in the catalog, entries with other keys get types after BuildingTypeCount
+const char* building_type_keys[BuildingTypeCount] = { "Construction", "City", "ElementCollector", "FireTower", "WaterTower", "GrassTower",
+	"FireBarracks", "WaterBarracks", "GrassBarracks", "SteamMachine", "WaterWheel", "Farm" };
+
 struct BuildingInfo
 {
+	std::string key;
+	std::string component = "Building"; // registered in building_classes
 	std::wstring name;
 	std::wstring description;
 	ElementType require_tile_type = ElementNone;
 	uint need_production = 15000;
 	uint hp_max = 3000;
-	graphics::ImagePtr image = nullptr;
+	int unit_type = -1; // what a barracks produces
+	bool constructible = false;
+	LazyImage image;
 };
-BuildingInfo building_infos[BuildingTypeCount];
+std::vector<BuildingInfo> building_infos;
 
-std::vector<BuildingType> available_constructions = { BuildingSteamMachine, BuildingFireBarracks, BuildingWaterWheel, BuildingWaterBarracks, BuildingFarm, BuildingGrassBarracks };
+std::vector<BuildingType> available_constructions;
 
 enum UnitType
 {
@@ -162,16 +466,120 @@ enum UnitType
 	UnitTypeCount
 };
 
+const char* unit_type_keys[UnitTypeCount] = { "FireElemental", "WaterElemental", "GrassElemental" };
+
 struct UnitInfo
 {
+	std::string key;
 	std::wstring name;
 	std::wstring description;
 	uint need_production = 15000;
 	uint hp_max = 1000;
-	ElementType element_type;
-	graphics::ImagePtr image = nullptr;
+	ElementType element_type = ElementNone;
+	LazyImage image;
 };
-UnitInfo unit_infos[UnitTypeCount];
+std::vector<UnitInfo> unit_infos;
+
+struct TechInfo
+{
+	std::string key;
+	std::wstring name;
+	std::wstring description;
+	LazyImage image;
+	int need_value = 0;
+	int parent = -1;
+	std::vector<uint> children;
+};
+// topologically sorted (parents before children), index 0 is the root which every player starts with
+std::vector<TechInfo> tech_infos;
+
+// techs with effects in code, -1 if the data doesn't define them
+int tech_large_scale_planting = -1;
+int tech_gear_set = -1;
+int tech_ignite = -1;
+
+int find_tech_info(std::string_view key)
+{
+	for (auto i = 0; i < tech_infos.size(); i++)
+	{
+		if (tech_infos[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+// the order in the file is kept as long as parents come first, so tech indices (used by replays) stay stable
+void load_tech_infos(const std::filesystem::path& path)
+{
+	tech_infos.clear();
+	tech_infos.emplace_back().key = "root";
+
+	pugi::xml_document doc;
+	if (!doc.load_file(path.c_str()))
+	{
+		printf("cannot load techs: %s\n", path.string().c_str());
+		return;
+	}
+
+	struct Def
+	{
+		pugi::xml_node node;
+		std::string parent;
+		int state = 0; // 0: not placed, 1: placing, 2: placed
+	};
+	std::vector<Def> defs;
+	std::unordered_map<std::string, uint> def_map;
+	for (auto n : doc.first_child().children("tech"))
+	{
+		def_map[n.attribute("key").value()] = defs.size();
+		defs.push_back({ n, n.attribute("parent").value() });
+	}
+
+	std::function<int(uint)> place;
+	place = [&](uint i) -> int {
+		auto& d = defs[i];
+		if (d.state == 2)
+			return find_tech_info(d.node.attribute("key").value());
+		if (d.state == 1)
+		{
+			printf("tech cycle at: %s\n", d.node.attribute("key").value());
+			return -1;
+		}
+		d.state = 1;
+		auto parent = 0;
+		if (!d.parent.empty())
+		{
+			auto it = def_map.find(d.parent);
+			parent = it != def_map.end() ? place(it->second) : -1;
+			if (parent == -1)
+			{
+				printf("tech %s: bad parent %s\n", d.node.attribute("key").value(), d.parent.c_str());
+				parent = 0;
+			}
+		}
+		d.state = 2;
+		auto& t = tech_infos.emplace_back();
+		t.key = d.node.attribute("key").value();
+		t.name = pugi::as_wide(d.node.attribute("name").value());
+		t.description = pugi::as_wide(d.node.attribute("description").value());
+		if (auto image = d.node.attribute("image"); image)
+			t.image.path = pugi::as_wide(image.value());
+		else
+			t.image.path = L"assets/tech.png";
+		t.need_value = d.node.attribute("need_value").as_int();
+		t.parent = parent;
+		return tech_infos.size() - 1;
+	};
+	for (auto i = 0; i < defs.size(); i++)
+		place(i);
+
+	for (auto i = 1; i < tech_infos.size(); i++)
+		tech_infos[tech_infos[i].parent].children.push_back(i);
+
+	tech_large_scale_planting = find_tech_info("large_scale_planting");
+	tech_gear_set = find_tech_info("gear_set");
+	tech_ignite = find_tech_info("ignite");
+}
 
 const auto round_time = 30.f;
 float round_timer = round_time;
@@ -185,6 +593,225 @@ bool sig_one_third_sec = false;
 
 bool mass_production = false;
 
+// splitmix64, one stream per subsystem so that e.g. a change in unit behavior doesn't reshuffle the map
+struct Rng
+{
+	uint64_t state = 0;
+
+	void seed(uint s, uint stream)
+	{
+		state = (uint64_t(s) << 32) ^ (uint64_t(stream) * 0x9e3779b97f4a7c15ULL);
+	}
+
+	uint64_t next()
+	{
+		auto z = (state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	float range(float a, float b)
+	{
+		return a + (b - a) * (float(next() >> 40) / 16777216.f);
+	}
+
+	int range(int a, int b) // inclusive
+	{
+		return a + int(next() % uint64_t(b - a + 1));
+	}
+
+	template<typename T>
+	T& item(std::vector<T>& vec)
+	{
+		return vec[next() % vec.size()];
+	}
+};
+
+uint game_seed = 0;
+Rng rng_map;
+Rng rng_spawn;
+Rng rng_unit;
+Rng rng_ai;
+
+void seed_game(uint seed)
+{
+	game_seed = seed;
+	rng_map.seed(seed, 1);
+	rng_spawn.seed(seed, 2);
+	rng_unit.seed(seed, 3);
+	rng_ai.seed(seed, 4);
+}
+
+uint sim_frame = 0;
+
+// runs a job over a number of chunks on the worker threads and the calling thread, returns when all are done
+struct WorkerPool
+{
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable cv_work;
+	std::condition_variable cv_done;
+	std::function<void(uint)> job;
+	uint n_chunks = 0;
+	std::atomic<uint> next_chunk = 0;
+	uint busy = 0;
+	uint generation = 0;
+	bool quit = false;
+
+	void init(uint n_threads)
+	{
+		for (auto i = 0; i < n_threads; i++)
+		{
+			threads.emplace_back([this]() {
+				auto seen = 0U;
+				while (true)
+				{
+					{
+						std::unique_lock<std::mutex> lock(mtx);
+						cv_work.wait(lock, [&]() { return quit || generation != seen; });
+						if (quit)
+							return;
+						seen = generation;
+					}
+					work();
+					{
+						std::lock_guard<std::mutex> lock(mtx);
+						if (--busy == 0)
+							cv_done.notify_one();
+					}
+				}
+			});
+		}
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cv_work.notify_all();
+		for (auto& t : threads)
+			t.join();
+	}
+
+	void work()
+	{
+		uint c;
+		while ((c = next_chunk.fetch_add(1)) < n_chunks)
+			job(c);
+	}
+
+	void run(uint chunks, const std::function<void(uint)>& f)
+	{
+		if (chunks == 0)
+			return;
+		if (threads.empty() || chunks == 1)
+		{
+			for (auto i = 0; i < chunks; i++)
+				f(i);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			job = f;
+			n_chunks = chunks;
+			next_chunk = 0;
+			busy = threads.size();
+			generation++;
+		}
+		cv_work.notify_all();
+		work();
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_done.wait(lock, [&]() { return busy == 0; });
+		}
+	}
+};
+WorkerPool worker_pool;
+
+enum CommandType
+{
+	CommandConstruct,
+	CommandResearch,
+	CommandSetBuildingEnable,
+	CommandSetMassProduction
+};
+
+// everything a human player can do that changes the simulation, recorded in replays
+struct Command
+{
+	uint frame = 0;
+	uchar type;
+	uchar player;
+	ushort value; // building type, tech id or on/off
+	ushort tile;
+	ushort city_tile; // tile of the city that gives the order
+};
+static_assert(sizeof(Command) == 12);
+
+const char replay_magic[4] = { 'E', 'W', 'R', 'P' };
+const uint replay_version = 1;
+
+struct ReplayHeader
+{
+	char magic[4];
+	uint version;
+	uint seed;
+	float step;
+	uint main_player_ai;
+};
+
+bool main_player_ai = false;
+
+std::vector<Command> pending_commands;
+std::ofstream replay_out;
+std::vector<Command> replay_commands;
+uint replay_cursor = 0;
+bool replaying = false;
+
+bool begin_record(const std::filesystem::path& path)
+{
+	replay_out.open(path, std::ios::binary);
+	if (!replay_out.good())
+		return false;
+	ReplayHeader header;
+	memcpy(header.magic, replay_magic, sizeof(header.magic));
+	header.version = replay_version;
+	header.seed = game_seed;
+	header.step = fixed_step;
+	header.main_player_ai = main_player_ai ? 1 : 0;
+	replay_out.write((char*)&header, sizeof(header));
+	return true;
+}
+
+bool load_replay(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.good())
+		return false;
+	ReplayHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || memcmp(header.magic, replay_magic, sizeof(header.magic)) != 0 || header.version != replay_version)
+		return false;
+	seed_game(header.seed);
+	fixed_step = header.step;
+	main_player_ai = header.main_player_ai != 0;
+	Command c;
+	while (file.read((char*)&c, sizeof(c)))
+		replay_commands.push_back(c);
+	replay_cursor = 0;
+	replaying = true;
+	return true;
+}
+
+inline void issue_command(const Command& c)
+{
+	if (!replaying)
+		pending_commands.push_back(c);
+}
+
 enum ProductionType
 {
 	ProductionBuilding,
@@ -205,125 +832,294 @@ struct Production
 	std::function<void()> callback = nullptr;
 };
 
+// per player research state, parallel to tech_infos
 struct Technology
 {
-	Technology* parent = nullptr;
-	std::vector<Technology*> children;
-
-	std::wstring name;
-	std::wstring description;
-	graphics::ImagePtr image = nullptr;
 	bool completed = false;
 	bool researching = false;
-	int need_value;
 	int value = 0;
 	int value_change = 0;
 	int value_avg = 0;
 	int value_one_sec_accumulate = 0;
-
-	void attach(Technology* _parent)
-	{
-		parent = _parent;
-		parent->children.push_back(this);
-	}
-
-	void start_researching()
-	{
-		if (!completed)
-			researching = true;
-
-		value_change = 0;
-		value_avg = 0;
-		value_one_sec_accumulate = 0;
-
-		if (parent)
-			parent->start_researching();
-	}
-
-	void stop_researching()
-	{
-		researching = false;
-		for (auto c : children)
-			c->stop_researching();
-	}
 };
 
 struct cPlayer;
 struct cBuilding;
 struct cCity;
 
-struct cTile : Component
+enum TileDirection
 {
-	cElementPtr element = nullptr;
-	cPolygonPtr polygon = nullptr;
-
-	uint id;
-	ElementType element_type;
-	cCity* owner_city = nullptr;
-	cBuilding* building = nullptr;
+	TileLT,
+	TileT,
+	TileRT,
+	TileLB,
+	TileB,
+	TileRB,
+	TileDirectionCount
+};
 
-	cTile* tile_lt = nullptr;
-	cTile* tile_t = nullptr;
-	cTile* tile_rt = nullptr;
-	cTile* tile_lb = nullptr;
-	cTile* tile_b = nullptr;
-	cTile* tile_rb = nullptr;
+// offsets of the six neighbors in (x, y), columns with odd x are shifted down by half a tile
+constexpr int tile_neighbor_offsets[2][TileDirectionCount][2] = {
+	{ { -1, -1 }, { 0, -1 }, { +1, -1 }, { -1, 0 }, { 0, +1 }, { +1, 0 } },
+	{ { -1, 0 }, { 0, -1 }, { +1, 0 }, { -1, +1 }, { 0, +1 }, { +1, +1 } }
+};
 
-	bool highlighted = false;
+// the hex edge between corner i and i + 1 (see arc_point) faces this direction
+constexpr TileDirection tile_edge_directions[6] = { TileRB, TileB, TileLB, TileLT, TileT, TileRT };
 
-	cTile() { type_hash = "cTile"_h; }
-	virtual ~cTile() {}
+struct Tile;
 
-	void on_init() override;
+inline Tile* get_tile(int x, int y);
 
-	std::vector<cTile*> get_adjacent()
-	{
-		std::vector<cTile*> ret;
-		if (tile_lt)
-			ret.push_back(tile_lt);
-		if (tile_t)
-			ret.push_back(tile_t);
-		if (tile_rt)
-			ret.push_back(tile_rt);
-		if (tile_lb)
-			ret.push_back(tile_lb);
-		if (tile_b)
-			ret.push_back(tile_b);
-		if (tile_rb)
-			ret.push_back(tile_rb);
+// axial hex coordinates (q, r) of the (x, y) offset layout
+inline ivec2 offset_to_axial(const ivec2& c)
+{
+	return ivec2(c.x, c.y - (c.x - (c.x & 1)) / 2);
+}
+
+inline ivec2 axial_to_offset(const ivec2& a)
+{
+	return ivec2(a.x, a.y + (a.x - (a.x & 1)) / 2);
+}
+
+inline int hex_distance(const ivec2& a, const ivec2& b)
+{
+	auto d = a - b;
+	return (abs(d.x) + abs(d.y) + abs(d.x + d.y)) / 2;
+}
+
+// offset coord of the tile under a world position (tile (0, 0) is centered at the origin)
+inline ivec2 tile_coord_at(const vec2& pos)
+{
+	auto s = tile_sz * 0.5f;
+	auto q = pos.x / (s * 1.5f);
+	auto r = pos.y / tile_sz_y - q * 0.5f;
+	// cube rounding
+	auto x = q, z = r, y = -x - z;
+	auto rx = round(x), ry = round(y), rz = round(z);
+	auto dx = abs(rx - x), dy = abs(ry - y), dz = abs(rz - z);
+	if (dx > dy && dx > dz)
+		rx = -ry - rz;
+	else if (dy <= dz)
+		rz = -rx - ry;
+	return axial_to_offset(ivec2(rx, rz));
+}
+
+// axial offsets of all hexes at exactly 'radius' steps, cached per radius
+const std::vector<ivec2>& get_hex_ring(uint radius)
+{
+	static std::vector<std::vector<ivec2>> rings;
+	static const ivec2 dirs[6] = { ivec2(+1, 0), ivec2(+1, -1), ivec2(0, -1), ivec2(-1, 0), ivec2(-1, +1), ivec2(0, +1) };
+	if (rings.size() <= radius)
+		rings.resize(radius + 1);
+	auto& ring = rings[radius];
+	if (ring.empty())
+	{
+		if (radius == 0)
+			ring.push_back(ivec2(0));
+		else
+		{
+			auto h = dirs[4] * (int)radius;
+			for (auto i = 0; i < 6; i++)
+			{
+				for (auto j = 0; j < radius; j++)
+				{
+					ring.push_back(h);
+					h += dirs[i];
+				}
+			}
+		}
+	}
+	return ring;
+}
+
+struct TileAdjacency
+{
+	Tile* tiles[TileDirectionCount];
+	uint n = 0;
+
+	Tile** begin() { return tiles; }
+	Tile** end() { return tiles + n; }
+};
+
+// plain tile data, the map is a flat array of these and is drawn by tile_mesh, tiles have no entities
+struct Tile
+{
+	vec2 pos; // center
+
+	uint id;
+	ElementType element_type;
+	cCity* owner_city = nullptr;
+	uint territory_idx = 0; // index in owner_city->territories
+	uchar border_mask = 0; // bit i: the edge between corner i and i + 1 is a border of owner_city
+	cBuilding* building = nullptr;
+
+	ivec2 coord;
+
+	bool highlighted = false;
+
+	Tile* get_neighbor(TileDirection dir) const
+	{
+		auto& off = tile_neighbor_offsets[coord.x & 1][dir];
+		return get_tile(coord.x + off[0], coord.y + off[1]);
+	}
+
+	ivec2 axial() const
+	{
+		return offset_to_axial(coord);
+	}
+
+	TileAdjacency get_adjacent() const
+	{
+		TileAdjacency ret;
+		for (auto i = 0; i < TileDirectionCount; i++)
+		{
+			if (auto t = get_neighbor((TileDirection)i); t)
+				ret.tiles[ret.n++] = t;
+		}
 		return ret;
 	}
 };
 
-std::vector<cTile*> get_nearby_tiles(cTile* tile, uint level = 1)
+Tile tile_map[tile_cx * tile_cy];
+
+inline Tile* get_tile(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= tile_cx || y >= tile_cy)
+		return nullptr;
+	return &tile_map[y * tile_cx + x];
+}
+
+// visits the tiles 1 to 'level' steps away, ring by ring
+template<typename F>
+void for_each_nearby_tile(Tile* tile, uint level, const F& f)
 {
-	if (level == 0)
-		return {};
-	std::vector<cTile*> ret;
-	int start_idx = -1;
-	int end_idx = 0;
-	auto add_tile = [&](cTile* t) {
-		for (auto& _t : ret)
+	auto center = tile->axial();
+	for (auto r = 1; r <= level; r++)
+	{
+		for (auto& off : get_hex_ring(r))
 		{
-			if (_t == t)
-				return;
+			auto c = axial_to_offset(center + off);
+			if (auto t = get_tile(c.x, c.y); t)
+				f(t);
 		}
+	}
+}
+
+std::vector<Tile*> get_nearby_tiles(Tile* tile, uint level = 1)
+{
+	std::vector<Tile*> ret;
+	for_each_nearby_tile(tile, level, [&](Tile* t) {
 		ret.push_back(t);
+	});
+	return ret;
+}
+
+inline int tile_distance(Tile* a, Tile* b)
+{
+	return hex_distance(a->axial(), b->axial());
+}
+
+// the map is drawn hex by hex straight from the tile data, no entity per tile; tiles are grouped in chunks that
+// are culled against the view as a whole and keep their hex points and uvs (built once) next to the tints
+struct TileMesh
+{
+	static const uint chunk_sz = 16;
+
+	struct Chunk
+	{
+		uint x0, y0, x1, y1; // tile range
+		vec2 lt, rb;
+		std::vector<vec2> pts; // 6 per tile
+		std::vector<vec2> uvs;
+		std::vector<cvec4> tints; // 1 per tile, written in place, a tint change doesn't touch the geometry
+		bool built = false;
 	};
-	while (level > 0)
+
+	graphics::ImagePtr image = nullptr;
+	graphics::SamplerPtr sampler = nullptr;
+	uint chunks_x = 0;
+	uint chunks_y = 0;
+	std::vector<Chunk> chunks;
+
+	void init()
 	{
-		for (auto i = start_idx; i != end_idx; i++)
+		chunks_x = (tile_cx + chunk_sz - 1) / chunk_sz;
+		chunks_y = (tile_cy + chunk_sz - 1) / chunk_sz;
+		chunks.resize(chunks_x * chunks_y);
+		for (auto cy = 0; cy < chunks_y; cy++)
 		{
-			auto t = i == -1 ? tile : ret[i];
-			for (auto aj : t->get_adjacent())
-				add_tile(aj);
+			for (auto cx = 0; cx < chunks_x; cx++)
+			{
+				auto& c = chunks[cy * chunks_x + cx];
+				c.x0 = cx * chunk_sz;
+				c.y0 = cy * chunk_sz;
+				c.x1 = min(c.x0 + chunk_sz, (uint)tile_cx);
+				c.y1 = min(c.y0 + chunk_sz, (uint)tile_cy);
+				c.tints.assign((c.x1 - c.x0) * (c.y1 - c.y0), cvec4(255));
+			}
 		}
-		start_idx = end_idx;
-		end_idx = ret.size();
-		level--;
 	}
-	return ret;
-}
+
+	Chunk& get_chunk(Tile* tile)
+	{
+		return chunks[(tile->coord.y / chunk_sz) * chunks_x + tile->coord.x / chunk_sz];
+	}
+
+	void set_tint(Tile* tile, const cvec4& col)
+	{
+		auto& c = get_chunk(tile);
+		c.tints[(tile->coord.y - c.y0) * (c.x1 - c.x0) + (tile->coord.x - c.x0)] = col;
+	}
+
+	void build(Chunk& c)
+	{
+		c.pts.clear();
+		c.uvs.clear();
+		c.lt = vec2(+10000.f);
+		c.rb = vec2(-10000.f);
+		for (auto y = c.y0; y < c.y1; y++)
+		{
+			for (auto x = c.x0; x < c.x1; x++)
+			{
+				auto tile = get_tile(x, y);
+				vec4 uvs;
+				switch (tile->element_type)
+				{
+				case ElementFire: uvs = img_fire_tile.uvs; break;
+				case ElementWater: uvs = img_water_tile.uvs; break;
+				case ElementGrass: uvs = img_grass_tile.uvs; break;
+				}
+				auto pos = tile->pos;
+				for (auto i = 0; i < 6; i++)
+				{
+					auto v = arc_point(vec2(0.f), i * 60.f, 1.f);
+					c.pts.push_back(pos + v * tile_sz * 0.5f);
+					c.uvs.push_back(mix(uvs.xy(), uvs.zw(), v * 0.5f + 0.5f));
+				}
+				c.lt = min(c.lt, pos - vec2(tile_sz * 0.5f));
+				c.rb = max(c.rb, pos + vec2(tile_sz * 0.5f));
+			}
+		}
+		c.built = true;
+	}
+
+	void draw(graphics::CanvasPtr canvas, const vec2& view_lt, const vec2& view_rb)
+	{
+		auto view = image->get_view();
+		for (auto& c : chunks)
+		{
+			if (!c.built)
+				build(c);
+			if (c.rb.x < view_lt.x || c.rb.y < view_lt.y || c.lt.x > view_rb.x || c.lt.y > view_rb.y)
+				continue;
+			// one polygon per hex, the canvas has no call taking a whole chunk's vertices
+			for (auto i = 0; i < c.tints.size(); i++)
+				canvas->draw_image_polygon(view, 0, &c.pts[i * 6], &c.uvs[i * 6], 6, c.tints[i], sampler);
+		}
+	}
+};
+TileMesh tile_mesh;
 
 EntityPtr e_tiles_root = nullptr;
 cElementPtr tile_hover = nullptr;
@@ -335,7 +1131,7 @@ struct cBuilding : Component
 	EntityPtr e_content = nullptr;
 	cPlayer* player = nullptr;
 	cCity* city = nullptr;
-	cTile* tile = nullptr;
+	Tile* tile = nullptr;
 
 	BuildingType type;
 	bool dead = false;
@@ -358,17 +1154,26 @@ struct cBuilding : Component
 	void on_init() override;
 	void update() override;
 	virtual void on_show_ui(sHudPtr hud) {}
-	void set_building_enable(bool v)
+	// called by cPlayer::add_building once player, city, tile and type are set, before the entity is attached
+	virtual void on_added() {}
+	// takes population and adds to the city's yields, only called when the city recomputes them
+	virtual void update_yield() {}
+	void update_productions();
+	void set_building_enable(bool v);
+};
+
+// hands a city's free production and population to its buildings in turn,
+// a building that finished a work period or got disabled moves to the back of the queue
+struct ProductionScheduler
+{
+	std::vector<cBuilding*> order;
+
+	void add(cBuilding* b)
 	{
-		if (building_enable == v)
-			return;
-		building_enable = v;
-		if (!building_enable)
-		{
-			working = false;
-			low_priority = true;
-		}
+		order.push_back(b);
 	}
+
+	void run();
 };
 
 struct cConstruction : cBuilding
@@ -379,6 +1184,7 @@ struct cConstruction : cBuilding
 	virtual ~cConstruction() {}
 
 	void on_init() override;
+	void on_added() override;
 	void start() override;
 	void update() override;
 	void on_show_ui(sHudPtr hud) override;
@@ -392,8 +1198,11 @@ struct cCity : cBuilding
 
 	int surplus_food = 0;
 
-	int production_next_turn = 0;
-	int food_production_next_turn = 0;
+	// yields of the city and its buildings, only recomputed when yields_dirty is set
+	bool yields_dirty = true;
+	int yield_production = 0;
+	int yield_food = 0;
+	int yield_population = 0;
 
 	int free_population = 0;
 	int free_production = 0;
@@ -401,9 +1210,10 @@ struct cCity : cBuilding
 	bool unapplied_population = false;
 	int food_to_produce_population = 0;
 
-	std::vector<cTile*> territories;
+	std::vector<Tile*> territories;
 
 	EntityPtr buildings = nullptr;
+	ProductionScheduler scheduler;
 
 	cCity() { type_hash = "cCity"_h; }
 	virtual ~cCity() {}
@@ -443,28 +1253,18 @@ struct cCity : cBuilding
 		return true;
 	}
 
+	void on_added() override;
 	void update() override;
+	void update_yields();
 
-	bool has_territory(cTile* tile)
+	bool has_territory(Tile* tile)
 	{
-		for (auto t : territories)
-		{
-			if (t == tile)
-				return true;
-		}
-		return false;
+		return tile->owner_city == this;
 	}
 
-	void add_territory(cTile* tile)
-	{
-		if (!has_territory(tile))
-		{
-			territories.push_back(tile);
-			tile->owner_city = this;
-		}
-	}
+	void add_territory(Tile* tile);
 
-	cBuilding* get_building(cTile* tile)
+	cBuilding* get_building(Tile* tile)
 	{
 		for (auto& b : buildings->children)
 		{
@@ -486,31 +1286,13 @@ struct cElementCollector : cBuilding
 	void update() override;
 };
 
-struct cFireBarracks : cBuilding
-{
-	cFireBarracks() { type_hash = "cFireBarracks"_h; }
-	virtual ~cFireBarracks() {}
-
-	void start() override;
-	void update() override;
-};
-
-struct cWaterBarracks : cBuilding
-{
-	cWaterBarracks() { type_hash = "cWaterBarracks"_h; }
-	virtual ~cWaterBarracks() {}
-
-	void start() override;
-	void update() override;
-};
-
-struct cGrassBarracks : cBuilding
+// produces the catalog's unit_type of its building type
+struct cBarracks : cBuilding
 {
-	cGrassBarracks() { type_hash = "cGrassBarracks"_h; }
-	virtual ~cGrassBarracks() {}
+	cBarracks() { type_hash = "cBarracks"_h; }
+	virtual ~cBarracks() {}
 
 	void start() override;
-	void update() override;
 };
 
 struct cSteamMachine : cBuilding
@@ -520,7 +1302,7 @@ struct cSteamMachine : cBuilding
 	cSteamMachine() { type_hash = "cSteamMachine"_h; }
 	virtual ~cSteamMachine() {}
 
-	void update() override;
+	void update_yield() override;
 	void on_show_ui(sHudPtr hud) override;
 };
 
@@ -531,7 +1313,7 @@ struct cWaterWheel : cBuilding
 	cWaterWheel() { type_hash = "cWaterWheel"_h; }
 	virtual ~cWaterWheel() {}
 
-	void update() override;
+	void update_yield() override;
 	void on_show_ui(sHudPtr hud) override;
 };
 
@@ -542,230 +1324,801 @@ struct cFarm : cBuilding
 	cFarm() { type_hash = "cFarm"_h; }
 	virtual ~cFarm() {}
 
-	void update() override;
+	void update_yield() override;
 	void on_show_ui(sHudPtr hud) override;
 };
 
-enum StatusType
-{
-	StatusIgnited,
-	StatusPoisoned,
-	StatusCount
-};
+// building components by class name, a catalog entry picks its behavior through this instead of a switch in add_building
+std::unordered_map<std::string, std::function<cBuilding*()>> building_classes;
 
-struct Status
+template<typename T>
+void register_building_class(const std::string& name)
 {
-	float value = 0.f;
-	float resistance = 100.f;
-	float duration = 0.f;
-};
+	building_classes[name] = []() -> cBuilding* {
+		return new T;
+	};
+}
 
-struct cUnit : Component
+void register_building_classes()
 {
-	cElementPtr element = nullptr;
-	cBody2dPtr body2d = nullptr;
-	cPlayer* player = nullptr;
-
-	uint id = 0;
-	cvec4 color;
-	BuildingType type;
-	bool dead = false;
-	ElementType element_type;
-	int hp = 10;
-	int hp_max = 10;
-	Status statuses[StatusCount];
-
-	float attack_interval = 1.f;
-	float attack_range = 50.f;
-
-	bool has_target = true;
-	vec2 target_pos;
-	float find_timer = 0.f;
-	float shoot_timer = 0.f;
+	register_building_class<cBuilding>("Building");
+	register_building_class<cConstruction>("Construction");
+	register_building_class<cCity>("City");
+	register_building_class<cElementCollector>("ElementCollector");
+	register_building_class<cBarracks>("Barracks");
+	register_building_class<cSteamMachine>("SteamMachine");
+	register_building_class<cWaterWheel>("WaterWheel");
+	register_building_class<cFarm>("Farm");
+}
 
-	cUnit() { type_hash = "cUnit"_h; }
-	virtual ~cUnit() {}
+// catalogs are parsed from xml once and then read back from a flat binary cache while the sources are unchanged
+const char catalog_magic[4] = { 'E', 'W', 'C', 'T' };
+const uint catalog_cache_version = 1;
 
-	void on_init() override;
-	void update() override;
+struct CatalogWriter
+{
+	std::string data;
 
-	void take_damage(ElementType type, int value)
+	void u32(uint v)
 	{
-		hp -= value * element_effectiveness[type][element_type];
-		if (hp <= 0)
-			dead = true;
+		data.append((const char*)&v, sizeof(v));
 	}
 
-	void take_status_value(StatusType type, float v)
+	void u64(uint64_t v)
 	{
-		auto& s = statuses[type];
-		if (s.duration == 0.f)
-		{
-			s.value += v;
-			if (s.value >= s.resistance)
-			{
-				s.value = 0.f;
-				switch (type)
-				{
-				case StatusIgnited: s.duration = 6.f; break;
-				case StatusPoisoned: s.duration = 10.f; break;
-				}
-			}
-		}
+		data.append((const char*)&v, sizeof(v));
 	}
-};
-
-uint unit_id = 1;
-EntityPtr e_units_root = nullptr;
-
-struct cBullet : Component
-{
-	cElementPtr element = nullptr;
-	cBody2dPtr body2d = nullptr;
-	uint player_id = -1;
-
-	uint id = 0;
-	cvec4 color;
-	bool dead = false;
-	float ttl = 2.f;
-	ElementType element_type;
-	float status_values[StatusCount] = { 0.f };
-
-	vec2 velocity;
 
-	cBullet() { type_hash = "cBullet"_h; }
-	virtual ~cBullet() {}
+	void str(std::string_view v)
+	{
+		u32(v.size());
+		data.append(v);
+	}
 
-	void update() override;
+	void wstr(const std::wstring& v)
+	{
+		str(pugi::as_utf8(v));
+	}
 };
 
-uint bullet_id = 1;
-EntityPtr e_bullets_root = nullptr;
-
-cBullet* create_bullet(const vec2& pos, const vec2& velocity, ElementType element_type, cPlayer* player);
-
-struct cPlayer : Component
+struct CatalogReader
 {
-	cElementPtr element = nullptr;
-
-	uint id;
-	cvec4 color;
-	bool ai = false;
-
-	Technology* tech_tree = nullptr;
-	Technology* tech_large_scale_planting = nullptr;
-	Technology* tech_gear_set = nullptr;
-	Technology* tech_ignite = nullptr;
-	int science = 0;
-
-	int science_next_turn = 0;
-
-	EntityPtr cities = nullptr;
-
-	std::vector<vec2> border_lines;
+	const char* p;
+	const char* end;
+	bool ok = true;
 
-	cPlayer() { type_hash = "cPlayer"_h; }
-	virtual ~cPlayer() {}
-
-	void on_active() override
+	bool read(void* dst, size_t n)
 	{
-		cities = Entity::create();
-		cities->name = "cities";
-		cities->add_component<cElement>();
-		entity->add_child(cities);
+		if (!ok || end - p < n)
+			return ok = false;
+		memcpy(dst, p, n);
+		p += n;
+		return true;
 	}
 
-	void update() override;
-
-	cBuilding* add_building(cCity* city, BuildingType type, cTile* tile);
-	cUnit* add_unit(const vec2& pos, UnitType type);
+	uint u32()
+	{
+		uint v = 0;
+		read(&v, sizeof(v));
+		return v;
+	}
 
-	void update_border_lines()
+	uint64_t u64()
 	{
-		border_lines.clear();
-		for (auto& c : cities->children)
-		{
-			auto city = c->get_component<cCity>();
-			for (auto t : city->territories)
-			{
-				vec2 pos[6];
-				auto c = t->element->pos;
-				for (auto i = 0; i < 6; i++)
-					pos[i] = arc_point(c, i * 60.f, tile_sz * 0.5f);
-				if (!t->tile_rb || !city->has_territory(t->tile_rb))
-					make_line_strips<2>(pos[0], pos[1], border_lines);
-				if (!t->tile_b || !city->has_territory(t->tile_b))
-					make_line_strips<2>(pos[1], pos[2], border_lines);
-				if (!t->tile_lb || !city->has_territory(t->tile_lb))
-					make_line_strips<2>(pos[2], pos[3], border_lines);
-				if (!t->tile_lt || !city->has_territory(t->tile_lt))
-					make_line_strips<2>(pos[3], pos[4], border_lines);
-				if (!t->tile_t || !city->has_territory(t->tile_t))
-					make_line_strips<2>(pos[4], pos[5], border_lines);
-				if (!t->tile_rt || !city->has_territory(t->tile_rt))
-					make_line_strips<2>(pos[5], pos[0], border_lines);
-			}
-		}
+		uint64_t v = 0;
+		read(&v, sizeof(v));
+		return v;
 	}
 
-	bool has_territory(cTile* tile)
+	std::string str()
 	{
-		for (auto& c : cities->children)
+		auto n = u32();
+		if (!ok || end - p < n)
 		{
-			if (c->get_component<cCity>()->has_territory(tile))
-				return true;
+			ok = false;
+			return "";
 		}
-		return false;
+		std::string ret(p, n);
+		p += n;
+		return ret;
 	}
 
-	void init_tech_tree()
+	std::wstring wstr()
 	{
-		tech_tree = new Technology;
-		tech_tree->completed = true;
-
-		tech_large_scale_planting = new Technology;
-		tech_large_scale_planting->name = L"Large Scale Planting";
-		tech_large_scale_planting->description = L"Farm +1 Food for every adjacent Farm";
-		tech_large_scale_planting->image = graphics::Image::get(L"assets/tech.png");
-		tech_large_scale_planting->need_value = 12000;
-		tech_large_scale_planting->attach(tech_tree);
-
-		tech_gear_set = new Technology;
-		tech_gear_set->name = L"Gear Set";
-		tech_gear_set->description = L"Steam Machine and Water Wheel +1 Production";
-		tech_gear_set->image = graphics::Image::get(L"assets/tech.png");
-		tech_gear_set->need_value = 12000;
-		tech_gear_set->attach(tech_tree);
-
-		tech_ignite = new Technology;
-		tech_ignite->name = L"Ignite";
-		tech_ignite->description = L"Fire attacks may cause target Ignited";
-		tech_ignite->image = graphics::Image::get(L"assets/tech.png");
-		tech_ignite->need_value = 12000;
-		tech_ignite->attach(tech_tree);
+		return pugi::as_wide(str());
 	}
 
-	Technology* get_researching()
+	// a record count, rejected when that many records of at least 'min_record_size' bytes can't fit in the rest
+	uint count(size_t min_record_size)
 	{
-		std::deque<Technology*> cands;
-		cands.push_back(tech_tree);
-		while (!cands.empty())
+		auto n = u32();
+		if (!ok || n > (end - p) / min_record_size)
 		{
-			auto t = cands.front();
-			cands.pop_front();
-			if (t->researching)
-				return t;
-			for (auto c : t->children)
-				cands.push_back(c);
+			ok = false;
+			return 0;
 		}
-		return nullptr;
+		return n;
 	}
 };
 
-cPlayer* main_player = nullptr;
+uint64_t catalog_source_stamp(const std::filesystem::path& path)
+{
+	std::error_code ec;
+	auto t = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return 0;
+	auto sz = std::filesystem::file_size(path, ec);
+	if (ec)
+		return 0;
+	return (uint64_t)t.time_since_epoch().count() ^ (sz << 40);
+}
+
+ElementType parse_element_type(std::string_view s)
+{
+	if (s == "Fire") return ElementFire;
+	if (s == "Water") return ElementWater;
+	if (s == "Grass") return ElementGrass;
+	return ElementNone;
+}
+
+// {production}, {food} etc. become the colored icon characters
+std::wstring parse_catalog_text(const char* s)
+{
+	auto ret = pugi::as_wide(s);
+	std::pair<const wchar_t*, wchar_t> icons[] = {
+		{ L"{food}", ch_icon_food },
+		{ L"{population}", ch_icon_population },
+		{ L"{production}", ch_icon_production },
+		{ L"{science}", ch_icon_science }
+	};
+	for (auto& i : icons)
+	{
+		auto token = std::wstring_view(i.first);
+		for (auto pos = ret.find(token); pos != std::wstring::npos; pos = ret.find(token, pos))
+		{
+			wchar_t rep[] = { ch_color_white, i.second, ch_color_end };
+			ret.replace(pos, token.size(), rep, 3);
+			pos += 3;
+		}
+	}
+	return ret;
+}
+
+// built-in keys keep their enum index, anything else is appended
+template<typename T>
+uint get_catalog_slot(std::vector<T>& infos, const char* const* builtin_keys, uint builtin_count, const std::string& key)
+{
+	for (auto i = 0; i < builtin_count; i++)
+	{
+		if (key == builtin_keys[i])
+			return i;
+	}
+	for (auto i = builtin_count; i < infos.size(); i++)
+	{
+		if (infos[i].key == key)
+			return i;
+	}
+	infos.emplace_back().key = key;
+	return infos.size() - 1;
+}
+
+int find_unit_type(const std::string& key)
+{
+	for (auto i = 0; i < unit_infos.size(); i++)
+	{
+		if (unit_infos[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+bool parse_catalogs(const std::filesystem::path& buildings_path, const std::filesystem::path& units_path)
+{
+	pugi::xml_document units_doc;
+	if (!units_doc.load_file(units_path.c_str()))
+	{
+		printf("cannot load units: %s\n", units_path.string().c_str());
+		return false;
+	}
+	for (auto n : units_doc.first_child().children("unit"))
+	{
+		auto& info = unit_infos[get_catalog_slot(unit_infos, unit_type_keys, UnitTypeCount, n.attribute("key").value())];
+		info.name = pugi::as_wide(n.attribute("name").value());
+		info.description = parse_catalog_text(n.attribute("description").value());
+		info.need_production = n.attribute("need_production").as_uint(info.need_production);
+		info.hp_max = n.attribute("hp_max").as_uint(info.hp_max);
+		info.element_type = parse_element_type(n.attribute("element").value());
+		info.image.path = pugi::as_wide(n.attribute("image").value());
+	}
+
+	pugi::xml_document buildings_doc;
+	if (!buildings_doc.load_file(buildings_path.c_str()))
+	{
+		printf("cannot load buildings: %s\n", buildings_path.string().c_str());
+		return false;
+	}
+	for (auto n : buildings_doc.first_child().children("building"))
+	{
+		auto type = get_catalog_slot(building_infos, building_type_keys, BuildingTypeCount, n.attribute("key").value());
+		auto& info = building_infos[type];
+		if (auto a = n.attribute("component"); a)
+			info.component = a.value();
+		info.name = pugi::as_wide(n.attribute("name").value());
+		info.description = parse_catalog_text(n.attribute("description").value());
+		info.require_tile_type = parse_element_type(n.attribute("require_tile").value());
+		info.need_production = n.attribute("need_production").as_uint(info.need_production);
+		info.hp_max = n.attribute("hp_max").as_uint(info.hp_max);
+		if (auto a = n.attribute("unit"); a)
+			info.unit_type = find_unit_type(a.value());
+		info.constructible = n.attribute("constructible").as_bool();
+		info.image.path = pugi::as_wide(n.attribute("image").value());
+	}
+	return true;
+}
+
+void write_catalog_cache(const std::filesystem::path& path, uint64_t stamp)
+{
+	CatalogWriter w;
+	w.data.append(catalog_magic, sizeof(catalog_magic));
+	w.u32(catalog_cache_version);
+	w.u64(stamp);
+	w.u32(unit_infos.size());
+	for (auto& info : unit_infos)
+	{
+		w.str(info.key);
+		w.wstr(info.name);
+		w.wstr(info.description);
+		w.u32(info.need_production);
+		w.u32(info.hp_max);
+		w.u32(info.element_type);
+		w.wstr(info.image.path.wstring());
+	}
+	w.u32(building_infos.size());
+	for (auto& info : building_infos)
+	{
+		w.str(info.key);
+		w.str(info.component);
+		w.wstr(info.name);
+		w.wstr(info.description);
+		w.u32(info.require_tile_type);
+		w.u32(info.need_production);
+		w.u32(info.hp_max);
+		w.u32(info.unit_type);
+		w.u32(info.constructible);
+		w.wstr(info.image.path.wstring());
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(w.data.data(), w.data.size());
+}
+
+bool read_catalog_cache(const std::filesystem::path& path, uint64_t stamp)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.good())
+		return false;
+	// one bulk read, everything is decoded straight from the buffer
+	std::string data(file.tellg(), '\0');
+	file.seekg(0);
+	file.read(data.data(), data.size());
+
+	CatalogReader r = { data.data(), data.data() + data.size() };
+	char magic[4];
+	if (!r.read(magic, sizeof(magic)) || memcmp(magic, catalog_magic, sizeof(magic)) != 0 ||
+		r.u32() != catalog_cache_version || r.u64() != stamp)
+		return false;
+	// smallest records: every string empty (a 4 byte length each) plus the fixed fields
+	const auto min_unit_size = 4 * 4 + 3 * 4;
+	const auto min_building_size = 5 * 4 + 5 * 4;
+	std::vector<UnitInfo> units(r.count(min_unit_size));
+	for (auto& info : units)
+	{
+		if (!r.ok)
+			break;
+		info.key = r.str();
+		info.name = r.wstr();
+		info.description = r.wstr();
+		info.need_production = r.u32();
+		info.hp_max = r.u32();
+		info.element_type = (ElementType)r.u32();
+		info.image.path = r.wstr();
+	}
+	std::vector<BuildingInfo> buildings(r.count(min_building_size));
+	for (auto& info : buildings)
+	{
+		if (!r.ok)
+			break;
+		info.key = r.str();
+		info.component = r.str();
+		info.name = r.wstr();
+		info.description = r.wstr();
+		info.require_tile_type = (ElementType)r.u32();
+		info.need_production = r.u32();
+		info.hp_max = r.u32();
+		info.unit_type = r.u32();
+		info.constructible = r.u32();
+		info.image.path = r.wstr();
+	}
+	if (!r.ok || units.size() < UnitTypeCount || buildings.size() < BuildingTypeCount)
+		return false;
+	unit_infos = std::move(units);
+	building_infos = std::move(buildings);
+	return true;
+}
+
+void load_catalogs(const std::filesystem::path& buildings_path, const std::filesystem::path& units_path, const std::filesystem::path& cache_path)
+{
+	auto stamp = catalog_source_stamp(buildings_path) * 31 + catalog_source_stamp(units_path);
+	if (!read_catalog_cache(cache_path, stamp))
+	{
+		unit_infos.clear();
+		unit_infos.resize(UnitTypeCount);
+		for (auto i = 0; i < UnitTypeCount; i++)
+			unit_infos[i].key = unit_type_keys[i];
+		building_infos.clear();
+		building_infos.resize(BuildingTypeCount);
+		for (auto i = 0; i < BuildingTypeCount; i++)
+			building_infos[i].key = building_type_keys[i];
+		if (parse_catalogs(buildings_path, units_path))
+			write_catalog_cache(cache_path, stamp);
+	}
+
+	available_constructions.clear();
+	for (auto i = 0; i < building_infos.size(); i++)
+	{
+		if (building_infos[i].constructible)
+			available_constructions.push_back((BuildingType)i);
+	}
+}
+
+enum StatusType
+{
+	StatusIgnited,
+	StatusPoisoned,
+	StatusCount
+};
+
+struct Status
+{
+	float value = 0.f;
+	float resistance = 100.f;
+	float duration = 0.f;
+};
+
+// hot unit state lives in UnitStore, the entity only renders and carries the physics body
+struct cUnit : Component
+{
+	cElementPtr element = nullptr;
+	cBody2dPtr body2d = nullptr;
+	cPlayer* player = nullptr;
+
+	uint id = 0;
+	uint idx = 0; // index in unit_store, kept up to date on removal
+	cvec4 color;
+	bool dead = false; // set once removed from unit_store, the entity goes away in flush_destroyed()
+
+	cUnit() { type_hash = "cUnit"_h; }
+	virtual ~cUnit() {}
+
+	void take_damage(ElementType type, int value);
+	void take_status_value(StatusType type, float v);
+};
+
+template<typename T>
+inline void swap_pop(std::vector<T>& vec, uint idx)
+{
+	if (idx != vec.size() - 1)
+		vec[idx] = std::move(vec.back());
+	vec.pop_back();
+}
+
+struct UnitStore
+{
+	std::vector<cUnit*> proxies;
+	std::vector<uint> ids;
+	std::vector<uint> player_ids;
+	std::vector<ElementType> element_types;
+	std::vector<vec2> pos;
+	std::vector<vec2> vel;
+	std::vector<vec2> force;
+	std::vector<float> radius;
+	std::vector<int> hp;
+	std::vector<int> hp_max;
+	std::vector<Status> statuses[StatusCount];
+	std::vector<float> attack_interval;
+	std::vector<float> attack_range;
+	std::vector<uchar> has_target;
+	std::vector<vec2> target_pos;
+	std::vector<float> find_timer;
+	std::vector<float> shoot_timer;
+	std::vector<uchar> dead;
+
+	uint size() const { return proxies.size(); }
+
+	uint add(cUnit* proxy, uint player_id, ElementType element_type, int _hp_max, const vec2& _pos)
+	{
+		proxies.push_back(proxy);
+		ids.push_back(proxy->id);
+		player_ids.push_back(player_id);
+		element_types.push_back(element_type);
+		pos.push_back(_pos);
+		vel.push_back(vec2(0.f));
+		force.push_back(vec2(0.f));
+		radius.push_back(proxy->body2d->radius);
+		hp.push_back(_hp_max);
+		hp_max.push_back(_hp_max);
+		for (auto i = 0; i < StatusCount; i++)
+			statuses[i].push_back({});
+		attack_interval.push_back(1.f);
+		attack_range.push_back(50.f);
+		has_target.push_back(false);
+		target_pos.push_back(vec2(0.f));
+		find_timer.push_back(0.f);
+		shoot_timer.push_back(0.f);
+		dead.push_back(false);
+		return proxies.size() - 1;
+	}
+
+	void remove(uint idx)
+	{
+		swap_pop(proxies, idx);
+		swap_pop(ids, idx);
+		swap_pop(player_ids, idx);
+		swap_pop(element_types, idx);
+		swap_pop(pos, idx);
+		swap_pop(vel, idx);
+		swap_pop(force, idx);
+		swap_pop(radius, idx);
+		swap_pop(hp, idx);
+		swap_pop(hp_max, idx);
+		for (auto i = 0; i < StatusCount; i++)
+			swap_pop(statuses[i], idx);
+		swap_pop(attack_interval, idx);
+		swap_pop(attack_range, idx);
+		swap_pop(has_target, idx);
+		swap_pop(target_pos, idx);
+		swap_pop(find_timer, idx);
+		swap_pop(shoot_timer, idx);
+		swap_pop(dead, idx);
+		if (idx < proxies.size())
+			proxies[idx]->idx = idx;
+	}
+
+	void take_damage(uint idx, ElementType type, int value)
+	{
+		hp[idx] -= value * element_effectiveness[type][element_types[idx]];
+		if (hp[idx] <= 0)
+			dead[idx] = true;
+	}
+
+	void take_status_value(uint idx, StatusType type, float v)
+	{
+		auto& s = statuses[type][idx];
+		if (s.duration == 0.f)
+		{
+			s.value += v;
+			if (s.value >= s.resistance)
+			{
+				s.value = 0.f;
+				switch (type)
+				{
+				case StatusIgnited: s.duration = 6.f; break;
+				case StatusPoisoned: s.duration = 10.f; break;
+				}
+			}
+		}
+	}
+
+	struct Shot
+	{
+		uint idx;
+		vec2 dir;
+	};
+
+	// think() only reads shared state and writes its own unit's slots, anything else becomes an intent
+	static const uint chunk_size = 256;
+	std::vector<std::vector<Shot>> chunk_shots;
+	std::vector<std::pair<uint, vec2>> city_targets; // (player id, pos)
+
+	void gather();
+	void find_target(uint idx);
+	void think(uint begin, uint end, std::vector<Shot>& shots);
+	void update();
+};
+UnitStore unit_store;
+
+void cUnit::take_damage(ElementType type, int value)
+{
+	unit_store.take_damage(idx, type, value);
+}
+
+void cUnit::take_status_value(StatusType type, float v)
+{
+	unit_store.take_status_value(idx, type, v);
+}
+
+uint unit_id = 1;
+EntityPtr e_units_root = nullptr;
+
+// units bucketed by (player, cell), rebuilt every tick with a counting sort
+struct UnitGrid
+{
+	float cell_sz = tile_sz;
+
+	vec2 origin;
+	uint cx = 0;
+	uint cy = 0;
+	uint n_players = 0;
+
+	std::vector<uint> cell_start;
+	std::vector<uint> unit_keys;
+	std::vector<uint> units;
+
+	void init(const vec2& lt, const vec2& rb)
+	{
+		origin = lt;
+		cx = uint((rb.x - lt.x) / cell_sz) + 1;
+		cy = uint((rb.y - lt.y) / cell_sz) + 1;
+	}
+
+	uvec2 get_cell(const vec2& pos) const
+	{
+		auto c = ivec2(floor((pos - origin) / cell_sz));
+		return uvec2(clamp(c.x, 0, (int)cx - 1), clamp(c.y, 0, (int)cy - 1));
+	}
+
+	void build(uint players);
+	int find_nearest_enemy(const vec2& pos, float range, uint player_id) const;
+	int sweep_enemy(const vec2& p0, const vec2& p1, float radius, uint player_id, float& t) const;
+};
+UnitGrid unit_grid;
+
+enum ContactKind : uchar
+{
+	ContactUnit,
+	ContactBuilding
+};
+
+struct cBullet;
+
+struct ContactEvent
+{
+	ContactKind target_kind;
+	Component* target;
+	cBullet* bullet;
+};
+
+// filled by update_bullets(), resolved afterwards in resolve_contacts()
+std::vector<ContactEvent> contact_events;
+
+struct cBullet : Component
+{
+	cElementPtr element = nullptr;
+	uint player_id = -1;
+
+	uint id = 0;
+	cvec4 color;
+	bool dead = false;
+	float ttl = 2.f;
+	float radius = 1.f;
+	ElementType element_type;
+	float status_values[StatusCount] = { 0.f };
+
+	vec2 velocity;
+
+	uint pool_idx = 0; // index in bullet_pool.actives while alive
+
+	cBullet() { type_hash = "cBullet"_h; }
+	virtual ~cBullet() {}
+};
+
+uint bullet_id = 1;
+EntityPtr e_bullets_root = nullptr;
+
+// dead bullets are disabled and kept in a per player free list
+struct BulletPool
+{
+	std::vector<std::vector<cBullet*>> free_lists;
+	std::vector<cBullet*> actives;
+	uint reserve_per_player = 0;
+
+	uint allocated = 0;
+	uint reused = 0;
+	uint high_water_mark = 0;
+
+	cBullet* acquire(cPlayer* player);
+	void release(cBullet* b);
+	void reserve(cPlayer* player, uint n);
+};
+BulletPool bullet_pool;
+
+cBullet* create_bullet(const vec2& pos, const vec2& velocity, ElementType element_type, cPlayer* player);
+
+struct cPlayer : Component
+{
+	cElementPtr element = nullptr;
+
+	uint id;
+	cvec4 color;
+	bool ai = false;
+
+	std::vector<Technology> techs;
+	int research_target = -1;
+	int researching = -1; // the first uncompleted tech on the way to research_target
+	int science = 0;
+
+	int science_next_turn = 0;
+
+	EntityPtr cities = nullptr;
+
+	struct BorderStrip
+	{
+		uint offset;
+		uint count;
+		bool closed;
+	};
+
+	std::vector<vec2> border_verts;
+	std::vector<BorderStrip> border_strips;
+	bool border_dirty = false;
+
+	cPlayer() { type_hash = "cPlayer"_h; }
+	virtual ~cPlayer() {}
+
+	void on_active() override
+	{
+		cities = Entity::create();
+		cities->name = "cities";
+		cities->add_component<cElement>();
+		entity->add_child(cities);
+	}
+
+	void update() override;
+
+	cBuilding* add_building(cCity* city, BuildingType type, Tile* tile);
+	cUnit* add_unit(const vec2& pos, UnitType type);
+
+	// border masks are kept up to date per tile, this stitches the border edges into polylines
+	// so the drawer can stroke the cached strips as they are
+	void update_border_lines()
+	{
+		PhaseScope scope(PhaseBorders);
+
+		struct Edge
+		{
+			vec2 a, b;
+			uint64_t ka, kb;
+		};
+		auto corner_key = [](const vec2& p) {
+			auto q = ivec2(round(p * 2.f));
+			return (uint64_t(uint(q.x)) << 32) | uint(q.y);
+		};
+
+		std::vector<Edge> edges;
+		for (auto& c : cities->children)
+		{
+			auto city = c->get_component<cCity>();
+			for (auto t : city->territories)
+			{
+				if (!t->border_mask)
+					continue;
+				vec2 pos[6];
+				auto c = t->pos;
+				for (auto i = 0; i < 6; i++)
+					pos[i] = arc_point(c, i * 60.f, tile_sz * 0.5f);
+				for (auto i = 0; i < 6; i++)
+				{
+					if (t->border_mask & (1 << i))
+					{
+						auto& e = edges.emplace_back();
+						e.a = pos[i];
+						e.b = pos[(i + 1) % 6];
+						e.ka = corner_key(e.a);
+						e.kb = corner_key(e.b);
+					}
+				}
+			}
+		}
+
+		// edges go around their tile in the same winding, so following end corner to start corner walks the border
+		std::vector<std::pair<uint64_t, uint>> starts(edges.size());
+		for (auto i = 0; i < edges.size(); i++)
+			starts[i] = { edges[i].ka, i };
+		std::sort(starts.begin(), starts.end());
+		std::vector<bool> used(edges.size(), false);
+		auto next_edge = [&](uint64_t k) {
+			for (auto it = std::lower_bound(starts.begin(), starts.end(), std::make_pair(k, 0U)); it != starts.end() && it->first == k; it++)
+			{
+				if (!used[it->second])
+					return (int)it->second;
+			}
+			return -1;
+		};
+
+		border_verts.clear();
+		border_strips.clear();
+		for (auto i = 0; i < edges.size(); i++)
+		{
+			if (used[i])
+				continue;
+			auto& strip = border_strips.emplace_back();
+			strip.offset = border_verts.size();
+			border_verts.push_back(edges[i].a);
+			auto cur = (int)i;
+			while (cur != -1)
+			{
+				used[cur] = true;
+				border_verts.push_back(edges[cur].b);
+				cur = next_edge(edges[cur].kb);
+			}
+			strip.count = border_verts.size() - strip.offset;
+			strip.closed = corner_key(border_verts.back()) == edges[i].ka;
+			if (strip.closed)
+			{
+				border_verts.pop_back();
+				strip.count--;
+			}
+		}
+		border_dirty = false;
+	}
+
+	bool has_territory(Tile* tile)
+	{
+		return tile->owner_city && tile->owner_city->player == this;
+	}
+
+	void init_techs()
+	{
+		techs.clear();
+		techs.resize(tech_infos.size());
+		techs[0].completed = true;
+	}
+
+	bool has_tech(int idx) const
+	{
+		return idx != -1 && techs[idx].completed;
+	}
+
+	void start_researching(uint idx)
+	{
+		stop_researching();
+		research_target = idx;
+		for (auto i = (int)idx; i != -1; i = tech_infos[i].parent)
+		{
+			auto& t = techs[i];
+			if (!t.completed)
+				t.researching = true;
+			t.value_change = 0;
+			t.value_avg = 0;
+			t.value_one_sec_accumulate = 0;
+		}
+		update_researching();
+	}
+
+	void stop_researching()
+	{
+		for (auto i = research_target; i != -1; i = tech_infos[i].parent)
+			techs[i].researching = false;
+		research_target = -1;
+		researching = -1;
+	}
+
+	// only needed when the research path changes or a tech on it completes
+	void update_researching()
+	{
+		researching = -1;
+		for (auto i = research_target; i != -1; i = tech_infos[i].parent)
+		{
+			if (techs[i].researching)
+				researching = i;
+		}
+	}
+};
+
+cPlayer* main_player = nullptr;
 EntityPtr e_players_root = nullptr;
 
-cPlayer* add_player(cTile* tile)
+cPlayer* add_player(Tile* tile)
 {
 	auto e = Entity::create();
 	auto element = e->add_component<cElement>();
@@ -776,42 +2129,94 @@ cPlayer* add_player(cTile* tile)
 	e->add_component_p(p);
 	e_players_root->add_child(e);
 	p->add_building(nullptr, BuildingCity, tile);
-	p->init_tech_tree();
+	p->init_techs();
 	return p;
 }
 
-void cTile::on_init()
-{
-	element->drawers.add([this](graphics::CanvasPtr ui_canvas) {
-		if (highlighted)
-		{
-			auto v = clamp(sin(fract(total_time) * pi<float>()) * 0.25f + 0.25f, 0.f, 1.f);
-			polygon->color = cvec4(cvec3(v * 255.f), 255);
-		}
-		else
-			polygon->color = cvec4(255);
-	});
-}
-
 void draw_bar(graphics::CanvasPtr ui_canvas, const vec2& p, float w, float h, const cvec4& col)
 {
 	ui_canvas->draw_rect_filled(p, p + vec2(w, h), col);
 }
 
+// health and progress bars of all units and buildings, read straight from the unit store and the cities
+// by a single drawer instead of one lambda per entity, anything outside the view is skipped
+struct BarOverlay
+{
+	vec2 view_lt;
+	vec2 view_rb;
+	uint drawn = 0;
+	uint culled = 0;
+
+	bool visible(const vec2& p) const
+	{
+		return p.x >= view_lt.x && p.y >= view_lt.y && p.x <= view_rb.x && p.y <= view_rb.y;
+	}
+
+	void draw_building(graphics::CanvasPtr canvas, cBuilding* b)
+	{
+		auto pos = b->tile->pos;
+		if (!visible(pos))
+		{
+			culled++;
+			return;
+		}
+		const auto len = 20.f;
+		draw_bar(canvas, pos - vec2(len * 0.5f, 12.f), (float)b->hp / (float)b->hp_max * len, 2, b->player->color);
+		if (b->type == BuildingConstruction && !b->productions.empty())
+		{
+			auto& p = b->productions[0];
+			draw_bar(canvas, pos - vec2(len * 0.5f, 10.f), (float)p.value / (float)p.need_value * len, 2, cvec4(255, 255, 127, 255));
+		}
+		drawn++;
+	}
+
+	void draw(graphics::CanvasPtr canvas, const vec2& lt, const vec2& rb)
+	{
+		view_lt = lt;
+		view_rb = rb;
+		drawn = 0;
+		culled = 0;
+
+		auto n = unit_store.size();
+		for (auto i = 0; i < n; i++)
+		{
+			auto pos = unit_store.pos[i];
+			if (!visible(pos))
+			{
+				culled++;
+				continue;
+			}
+			const auto len = 10.f;
+			auto r = (float)unit_store.hp[i] / (float)unit_store.hp_max[i];
+			draw_bar(canvas, pos - vec2(len * 0.5f, 5.f), r * len, 2, unit_store.proxies[i]->color);
+			drawn++;
+		}
+
+		for (auto& p : e_players_root->children)
+		{
+			auto player = p->get_component<cPlayer>();
+			for (auto& c : player->cities->children)
+			{
+				auto city = c->get_component<cCity>();
+				draw_building(canvas, city);
+				for (auto& b : city->buildings->children)
+					draw_building(canvas, b->get_base_component<cBuilding>());
+			}
+		}
+	}
+};
+BarOverlay bar_overlay;
+
 void cBuilding::on_init()
 {
 	element = entity->get_component<cElement>();
 	e_content = entity->first_child();
-
-	element->drawers.add([this](graphics::CanvasPtr ui_canvas) {
-		const auto len = 20.f;
-		auto r = ((float)hp / (float)hp_max);
-		draw_bar(ui_canvas, element->global_pos() - vec2(len * 0.5f, 12.f), r * len, 2, player->color);
-	});
 }
 
 void cBuilding::update()
 {
+	PhaseScope scope(PhaseEconomy);
+
 	if (working)
 	{
 		work_time += delta_time;
@@ -841,75 +2246,106 @@ void cBuilding::update()
 	else
 		work_time = 0.f;
 
-	if (building_enable)
+	if (sig_round)
 	{
-		for (auto it = productions.begin(); it != productions.end();)
+		auto pos = element->global_pos();
+		for (auto& u : ready_units)
 		{
-			it->value_change = 0;
-
-			if (sig_one_sec)
+			for (auto i = 0; i < u.second; i++)
 			{
-				it->value_avg = it->value_one_sec_accumulate;
-				it->value_one_sec_accumulate = 0;
+				auto x = pos.x + rng_spawn.range(-5.f, +5.f);
+				auto y = pos.y + rng_spawn.range(-5.f, +5.f);
+				auto c = player->add_unit(vec2(x, y), (UnitType)u.first);
 			}
+		}
+	}
+}
 
-			if (it->require_population)
-			{
-				if (!city->apply_population())
-					continue;
-			}
+void cBuilding::update_productions()
+{
+	for (auto it = productions.begin(); it != productions.end();)
+	{
+		it->value_change = 0;
 
-			auto v = city->apply_production(it->need_value - it->value);
-			if (v > 0)
+		if (sig_one_sec)
+		{
+			it->value_avg = it->value_one_sec_accumulate;
+			it->value_one_sec_accumulate = 0;
+		}
+
+		if (it->require_population)
+		{
+			if (!city->apply_population())
 			{
-				it->value_change = v;
-				it->value += it->value_change;
-				it->value_one_sec_accumulate += v;
-				working = true;
+				it++;
+				continue;
 			}
-			else if (it->require_population)
-				city->population += 1;
+		}
 
-			if (it->value >= it->need_value)
+		auto v = city->apply_production(it->need_value - it->value);
+		if (v > 0)
+		{
+			it->value_change = v;
+			it->value += it->value_change;
+			it->value_one_sec_accumulate += v;
+			working = true;
+		}
+		else if (it->require_population)
+			city->free_population += 1; // hand the population back, the yields did not change
+
+		if (it->value >= it->need_value)
+		{
+			if (it->callback)
+				it->callback();
+			else if (it->type == ProductionUnit)
 			{
-				if (it->callback)
-					it->callback();
-				else if (it->type == ProductionUnit)
+				auto added = false;
+				for (auto& ru : ready_units)
 				{
-					auto added = false;
-					for (auto& ru : ready_units)
+					if (ru.first == it->item_id)
 					{
-						if (ru.first == it->item_id)
-						{
-							ru.second++;
-							added = true;
-							break;
-						}
+						ru.second++;
+						added = true;
+						break;
 					}
-					if (!added)
-						ready_units.emplace_back(it->item_id, 1);
-				}
-				if (!it->repeat)
-					it = productions.erase(it);
-				else
-				{
-					it->value = 0;
-					it++;
 				}
+				if (!added)
+					ready_units.emplace_back(it->item_id, 1);
 			}
+			if (!it->repeat)
+				it = productions.erase(it);
 			else
+			{
+				it->value = 0;
 				it++;
+			}
 		}
+		else
+			it++;
 	}
+}
 
-	if (sig_round)
+void ProductionScheduler::run()
+{
+	auto n_demoted = 0;
+	for (auto b : order)
 	{
-		auto pos = element->global_pos();
-		for (auto& u : ready_units)
-		{
-			for (auto i = 0; i < u.second; i++)
-				auto c = player->add_unit(vec2(pos.x + linearRand(-5.f, +5.f), pos.y + linearRand(-5.f, +5.f)), (UnitType)u.first);
-		}
+		if (b->low_priority)
+			n_demoted++;
+	}
+	if (n_demoted > 0)
+	{
+		std::stable_partition(order.begin(), order.end(), [](cBuilding* b) {
+			return !b->low_priority;
+		});
+		for (auto i = order.size() - n_demoted; i < order.size(); i++)
+			order[i]->low_priority = false;
+	}
+
+	for (auto b : order)
+	{
+		if (!b->dead && b->building_enable)
+			b->update_productions();
 	}
 }
 
@@ -917,19 +2353,25 @@ void cConstruction::on_init()
 {
 	cBuilding::on_init();
 
-	element->drawers.add([this](graphics::CanvasPtr ui_canvas) {
-		if (!productions.empty())
-		{
-			auto& p = productions[0];
-			const auto len = 20.f;
-			auto r = ((float)p.value / (float)p.need_value);
-			draw_bar(ui_canvas, element->global_pos() - vec2(len * 0.5f, 10.f), r * len, 2, cvec4(255, 255, 127, 255));
-		}
-	});
-
 	max_work_time = 0.f;
 }
 
+void cConstruction::on_added()
+{
+	entity->get_component<cElement>()->ext *= 0.7f;
+	if (!headless)
+	{
+		auto movie = entity->add_component<cMovie>();
+		movie->images.push_back(img_hammer1->desc());
+		movie->images.push_back(img_hammer2->desc());
+		movie->speed = 0.25f;
+	}
+	hp = 0;
+
+	if (player == main_player)
+		play_sound(sound_construction_begin);
+}
+
 void cConstruction::start()
 {
 	Production p;
@@ -939,18 +2381,19 @@ void cConstruction::start()
 	p.callback = [this]() {
 		add_event([this]() {
 			player->add_building(construct_building == BuildingCity ? nullptr : city, construct_building, tile);
-			entity->remove_from_parent();
+			dead = true;
 			return false;
 		});
 
 		if (player == main_player)
-			sound_construction_end->play();
+			play_sound(sound_construction_end);
 	};
 	productions.push_back(p);
 }
 
 void cConstruction::update()
 {
+	PhaseScope scope(PhaseEconomy);
 	cBuilding::update();
 
 	if (!productions.empty())
@@ -969,8 +2412,16 @@ void cConstruction::on_show_ui(sHudPtr hud)
 
 }
 
+void cCity::on_added()
+{
+	add_territory(tile);
+	for (auto aj : tile->get_adjacent())
+		add_territory(aj);
+}
+
 void cCity::update()
 {
+	PhaseScope scope(PhaseEconomy);
 	cBuilding::update();
 
 	surplus_food += food_production;
@@ -980,25 +2431,73 @@ void cCity::update()
 		surplus_food = 0;
 		population += 1;
 		food_to_produce_population = calc_population_growth_food();
+		yields_dirty = true;
 	}
 
-	production = production_next_turn;
+	if (yields_dirty)
+		update_yields();
+
+	production = yield_production;
 	if (mass_production && player == main_player)
 		production += 100;
-	food_production = food_production_next_turn;
-	production_next_turn = 0;
-	production_next_turn += 10; // from city
-	food_production_next_turn = -population * 2;
-	food_production_next_turn += 12; // from city
+	food_production = yield_food;
 
-	free_population = population;
+	free_population = population - yield_population;
 	free_production = production;
 	no_production = true;
-	unapplied_population = true;
+	unapplied_population = yield_population == 0;
+
+	scheduler.run();
+}
+
+uint yield_recomputes = 0; // reported by headless runs, should stay far below cities * frames
+
+void cCity::update_yields()
+{
+	yield_recomputes++;
+	yield_production = 10; // from city
+	yield_food = 12; // from city
+	yield_food -= population * 2;
+
+	free_population = population;
+	for (auto& e : buildings->children)
+	{
+		auto b = e->get_base_component<cBuilding>();
+		if (!b->dead)
+			b->update_yield();
+	}
+	yield_population = population - free_population;
+	yields_dirty = false;
+}
+
+// yields can depend on neighbors (farms), so the cities around a changed tile recompute as well
+void mark_yields_dirty(Tile* tile)
+{
+	if (tile->owner_city)
+		tile->owner_city->yields_dirty = true;
+	for (auto aj : tile->get_adjacent())
+	{
+		if (aj->owner_city)
+			aj->owner_city->yields_dirty = true;
+	}
+}
+
+void cBuilding::set_building_enable(bool v)
+{
+	if (building_enable == v)
+		return;
+	building_enable = v;
+	if (!building_enable)
+	{
+		working = false;
+		low_priority = true;
+	}
+	mark_yields_dirty(tile);
 }
 
 void cElementCollector::update()
 {
+	PhaseScope scope(PhaseEconomy);
 	cBuilding::update();
 
 	timer += delta_time;
@@ -1015,10 +2514,8 @@ void cElementCollector::update()
 	}
 }
 
-void cSteamMachine::update()
+void cSteamMachine::update_yield()
 {
-	cBuilding::update();
-
 	working = false;
 	provide_production = 0;
 	if (building_enable)
@@ -1026,9 +2523,9 @@ void cSteamMachine::update()
 		if (city->apply_population())
 		{
 			provide_production = 2;
-			if (player->tech_gear_set->completed)
+			if (player->has_tech(tech_gear_set))
 				provide_production += 1;
-			city->production_next_turn += provide_production;
+			city->yield_production += provide_production;
 			working = true;
 		}
 	}
@@ -1037,13 +2534,11 @@ void cSteamMachine::update()
 void cSteamMachine::on_show_ui(sHudPtr hud)
 {
 	if (working)
-		hud->text(std::format(L"+{}{}{}{}", provide_production, ch_color_white, ch_icon_production, ch_color_end));
+		hud->text(hud_texts.get(this, L"+{}{}{}{}", provide_production, ch_color_white, ch_icon_production, ch_color_end));
 }
 
-void cWaterWheel::update()
+void cWaterWheel::update_yield()
 {
-	cBuilding::update();
-
 	working = false;
 	provide_production = 0;
 	if (building_enable)
@@ -1051,9 +2546,9 @@ void cWaterWheel::update()
 		if (city->apply_population())
 		{
 			provide_production = 2;
-			if (player->tech_gear_set->completed)
+			if (player->has_tech(tech_gear_set))
 				provide_production += 1;
-			city->production_next_turn += provide_production;
+			city->yield_production += provide_production;
 			working = true;
 		}
 	}
@@ -1062,13 +2557,11 @@ void cWaterWheel::update()
 void cWaterWheel::on_show_ui(sHudPtr hud)
 {
 	if (working)
-		hud->text(std::format(L"+{}{}{}{}", provide_production, ch_color_white, ch_icon_production, ch_color_end));
+		hud->text(hud_texts.get(this, L"+{}{}{}{}", provide_production, ch_color_white, ch_icon_production, ch_color_end));
 }
 
-void cFarm::update()
+void cFarm::update_yield()
 {
-	cBuilding::update();
-
 	working = false;
 	provide_food = 0;
 	if (building_enable)
@@ -1076,7 +2569,7 @@ void cFarm::update()
 		if (city->apply_population())
 		{
 			provide_food = 2;
-			if (player->tech_large_scale_planting->completed)
+			if (player->has_tech(tech_large_scale_planting))
 			{
 				for (auto aj : tile->get_adjacent())
 				{
@@ -1084,7 +2577,7 @@ void cFarm::update()
 						provide_food += 1;
 				}
 			}
-			city->food_production_next_turn += provide_food;
+			city->yield_food += provide_food;
 			working = true;
 		}
 	}
@@ -1093,229 +2586,473 @@ void cFarm::update()
 void cFarm::on_show_ui(sHudPtr hud)
 {
 	if (working)
-		hud->text(std::format(L"+{}{}{}{}", provide_food, ch_color_white, ch_icon_food, ch_color_end));
+		hud->text(hud_texts.get(this, L"+{}{}{}{}", provide_food, ch_color_white, ch_icon_food, ch_color_end));
 }
 
-void cFireBarracks::start()
+void cBarracks::start()
 {
+	auto unit_type = building_infos[type].unit_type;
+	if (unit_type < 0)
+		return;
 	Production p;
 	p.type = ProductionUnit;
-	p.item_id = UnitFireElemental;
+	p.item_id = unit_type;
 	p.need_value = unit_infos[p.item_id].need_production;
 	p.require_population = true;
 	p.repeat = true;
 	productions.push_back(p);
 }
 
-void cFireBarracks::update()
+void UnitGrid::build(uint players)
 {
-	cBuilding::update();
+	n_players = players;
+	auto n_cells = cx * cy;
+	auto n = unit_store.size();
+	cell_start.assign(n_players * n_cells + 1, 0);
+	unit_keys.resize(n);
+	units.resize(n);
+	for (auto i = 0; i < n; i++)
+	{
+		auto c = get_cell(unit_store.pos[i]);
+		auto key = unit_store.player_ids[i] * n_cells + c.y * cx + c.x;
+		unit_keys[i] = key;
+		cell_start[key + 1]++;
+	}
+	for (auto i = 1; i < cell_start.size(); i++)
+		cell_start[i] += cell_start[i - 1];
+	for (auto i = 0; i < n; i++)
+		units[cell_start[unit_keys[i]]++] = i;
+	// the fill pass advanced every start to the next bucket's start, shift it back
+	for (auto i = cell_start.size() - 1; i > 0; i--)
+		cell_start[i] = cell_start[i - 1];
+	cell_start[0] = 0;
 }
 
-void cWaterBarracks::start()
+// earliest time t in [0, 1] at which a circle moving p0 -> p1 touches a circle of radius r at c
+bool sweep_circle(const vec2& p0, const vec2& p1, const vec2& c, float r, float& t)
 {
-	Production p;
-	p.type = ProductionUnit;
-	p.item_id = UnitWaterElemental;
-	p.need_value = unit_infos[p.item_id].need_production;
-	p.require_population = true;
-	p.repeat = true;
-	productions.push_back(p);
+	auto d = p1 - p0;
+	auto m = p0 - c;
+	auto cc = dot(m, m) - r * r;
+	if (cc <= 0.f)
+	{
+		t = 0.f;
+		return true;
+	}
+	auto a = dot(d, d);
+	auto bb = dot(m, d);
+	if (a == 0.f || bb >= 0.f)
+		return false;
+	auto disc = bb * bb - a * cc;
+	if (disc < 0.f)
+		return false;
+	t = (-bb - sqrt(disc)) / a;
+	return t <= 1.f;
 }
 
-void cWaterBarracks::update()
+int UnitGrid::sweep_enemy(const vec2& p0, const vec2& p1, float radius, uint player_id, float& t) const
 {
-	cBuilding::update();
+	auto ret = -1;
+	auto n_cells = cx * cy;
+	// a unit is never larger than a cell, so one cell of margin covers everything the segment can touch
+	auto c0 = get_cell(min(p0, p1) - vec2(cell_sz));
+	auto c1 = get_cell(max(p0, p1) + vec2(cell_sz));
+	for (auto p = 0; p < n_players; p++)
+	{
+		if (p == player_id)
+			continue;
+		for (auto y = c0.y; y <= c1.y; y++)
+		{
+			auto row = p * n_cells + y * cx;
+			for (auto i = cell_start[row + c0.x]; i < cell_start[row + c1.x + 1]; i++)
+			{
+				auto u = units[i];
+				if (unit_store.dead[u])
+					continue;
+				auto unit_t = 0.f;
+				if (sweep_circle(p0, p1, unit_store.pos[u], unit_store.radius[u] + radius, unit_t) && unit_t < t)
+				{
+					t = unit_t;
+					ret = u;
+				}
+			}
+		}
+	}
+	return ret;
 }
 
-void cGrassBarracks::start()
+int UnitGrid::find_nearest_enemy(const vec2& pos, float range, uint player_id) const
 {
-	Production p;
-	p.type = ProductionUnit;
-	p.item_id = UnitGrassElemental;
-	p.need_value = unit_infos[p.item_id].need_production;
-	p.require_population = true;
-	p.repeat = true;
-	productions.push_back(p);
+	auto ret = -1;
+	auto min_dist = std::numeric_limits<float>::max();
+	auto n_cells = cx * cy;
+	auto c0 = get_cell(pos - vec2(range));
+	auto c1 = get_cell(pos + vec2(range));
+	for (auto p = 0; p < n_players; p++)
+	{
+		if (p == player_id)
+			continue;
+		for (auto y = c0.y; y <= c1.y; y++)
+		{
+			auto row = p * n_cells + y * cx;
+			for (auto i = cell_start[row + c0.x]; i < cell_start[row + c1.x + 1]; i++)
+			{
+				auto u = units[i];
+				auto d = unit_store.pos[u] - pos;
+				if (abs(d.x) > range || abs(d.y) > range)
+					continue;
+				auto dist = d.x * d.x + d.y * d.y;
+				if (dist < min_dist)
+				{
+					min_dist = dist;
+					ret = u;
+				}
+			}
+		}
+	}
+	return ret;
 }
 
-void cGrassBarracks::update()
+void UnitStore::gather()
 {
-	cBuilding::update();
-}
+	auto n = size();
+	for (auto i = 0; i < n; i++)
+	{
+		auto u = proxies[i];
+		pos[i] = u->element->pos;
+		vel[i] = u->body2d->get_velocity();
+	}
 
-void cUnit::on_init()
-{
-	element->drawers.add([this](graphics::CanvasPtr ui_canvas) {
-		const auto len = 10.f;
-		auto r = ((float)hp / (float)hp_max);
-		draw_bar(ui_canvas, element->global_pos() - vec2(len * 0.5f, 5.f), r * len, 2, player->color);
-	});
+	city_targets.clear();
+	for (auto& p : e_players_root->children)
+	{
+		auto player = p->get_component<cPlayer>();
+		for (auto& c : player->cities->children)
+			city_targets.emplace_back(player->id, c->get_component<cElement>()->pos);
+	}
 }
 
-void cUnit::update()
+void UnitStore::find_target(uint idx)
 {
-	auto pos = element->pos;
-	auto dist_to_tar = distance(pos, target_pos);
-
-	if (find_timer > 0.f)
-		find_timer -= delta_time;
-	if (find_timer <= 0.f)
+	has_target[idx] = false;
+	if (auto target = unit_grid.find_nearest_enemy(pos[idx], tile_sz * 2.f, player_ids[idx]); target != -1)
 	{
-		find_timer = linearRand(0.5f, 1.f);
+		has_target[idx] = true;
+		target_pos[idx] = pos[target];
+		return;
+	}
 
-		std::vector<std::pair<EntityPtr, float>> cands;
-		sScene::instance()->query_world2d(pos - vec2(tile_sz * 2.f), pos + vec2(tile_sz * 2.f), [&](EntityPtr e) {
-			auto character = e->get_component<cUnit>();
-			if (character && character->player != player)
-			{
-				auto dist = distance(character->element->pos, element->pos);
-				cands.emplace_back(e, dist);
-			}
-		});
-		if (cands.empty())
+	auto min_dist = std::numeric_limits<float>::max();
+	for (auto& ct : city_targets)
+	{
+		if (ct.first != player_ids[idx])
 		{
-			for (auto& p : e_players_root->children)
+			auto dist = distance(ct.second, pos[idx]);
+			if (dist < min_dist)
 			{
-				auto player = p->get_component<cPlayer>();
-				if (player != this->player)
-				{
-					for (auto& c : player->cities->children)
-					{
-						auto dist = distance(c->get_component<cElement>()->pos, element->pos);
-						cands.emplace_back(c.get(), dist);
-					}
-				}
+				min_dist = dist;
+				has_target[idx] = true;
+				target_pos[idx] = ct.second;
 			}
 		}
-		if (!cands.empty())
+	}
+}
+
+void UnitStore::think(uint begin, uint end, std::vector<Shot>& shots)
+{
+	for (auto i = begin; i < end; i++)
+	{
+		if (find_timer[i] > 0.f)
+			find_timer[i] -= delta_time;
+		if (find_timer[i] <= 0.f)
 		{
-			has_target = true;
-			std::sort(cands.begin(), cands.end(), [](const auto& a, const auto& b) {
-				return a.second < b.second;
-			});
-			target_pos = cands.front().first->get_component<cElement>()->pos;
+			// keyed by unit and frame so the result doesn't depend on which thread runs it
+			Rng rng;
+			rng.state = rng_unit.state ^ (uint64_t(ids[i]) << 32) ^ sim_frame;
+			find_timer[i] = rng.range(0.5f, 1.f);
+			find_target(i);
 		}
-		else
-			has_target = false;
 	}
+
+	for (auto i = begin; i < end; i++)
 	{
 		auto t = vec2(0.f);
-		if (has_target)
-		{
-			if (dist_to_tar > attack_range)
-				t = normalize(target_pos - pos) * 32.f/*max speed*/;
-		}
-		auto f = t - body2d->get_velocity();
-		f *= body2d->mass;
-		body2d->apply_force(f);
+		if (has_target[i] && distance(pos[i], target_pos[i]) > attack_range[i])
+			t = normalize(target_pos[i] - pos[i]) * 32.f/*max speed*/;
+		force[i] = t - vel[i];
 	}
 
-	if (shoot_timer > 0.f)
-		shoot_timer -= delta_time;
-	if (shoot_timer <= 0.f)
+	for (auto i = begin; i < end; i++)
 	{
-		if (has_target && dist_to_tar <= attack_range + 1.f)
+		if (shoot_timer[i] > 0.f)
+			shoot_timer[i] -= delta_time;
+		if (shoot_timer[i] <= 0.f)
 		{
-			shoot_timer = attack_interval;
-			auto dir = normalize(target_pos - pos);
-			create_bullet(pos + dir * body2d->radius, dir * 100.f, element_type, player);
+			if (has_target[i] && distance(pos[i], target_pos[i]) <= attack_range[i] + 1.f)
+			{
+				shoot_timer[i] = attack_interval[i];
+				shots.push_back({ i, normalize(target_pos[i] - pos[i]) });
+			}
 		}
 	}
 
-	for (auto i = 0; i < StatusCount; i++)
+	for (auto j = 0; j < StatusCount; j++)
 	{
-		auto& s = statuses[i];
-		if (s.duration > 0.f)
+		auto& ss = statuses[j];
+		for (auto i = begin; i < end; i++)
 		{
-			switch (i)
+			auto& s = ss[i];
+			if (s.duration > 0.f)
 			{
-			case StatusIgnited:
-				if (sig_one_third_sec)
-					take_damage(ElementFire, hp_max / (100 * 3));
-				break;
-			case StatusPoisoned:
 				if (sig_one_third_sec)
-					take_damage(ElementGrass, hp_max / (100 * 5));
-				break;
+				{
+					switch (j)
+					{
+					case StatusIgnited:
+						take_damage(i, ElementFire, hp_max[i] / (100 * 3));
+						break;
+					case StatusPoisoned:
+						take_damage(i, ElementGrass, hp_max[i] / (100 * 5));
+						break;
+					}
+				}
+				s.duration -= delta_time;
+				if (s.duration <= 0.f)
+					s.duration = 0.f;
 			}
-			s.duration -= delta_time;
-			if (s.duration <= 0.f)
-				s.duration = 0.f;
 		}
 	}
 }
 
-void cBullet::update()
+void UnitStore::update()
 {
-	body2d->set_velocity(velocity);
+	auto n = size();
+	auto n_chunks = (n + chunk_size - 1) / chunk_size;
+	if (chunk_shots.size() < n_chunks)
+		chunk_shots.resize(n_chunks);
+	worker_pool.run(n_chunks, [&](uint c) {
+		auto& shots = chunk_shots[c];
+		shots.clear();
+		think(c * chunk_size, min((c + 1) * chunk_size, n), shots);
+	});
 
-	ttl -= delta_time;
-	if (ttl <= 0.f)
-		dead = true;
+	// merge in chunk order, which is the unit order no matter how the chunks were spread over threads
+	for (auto i = 0; i < n; i++)
+	{
+		auto body2d = proxies[i]->body2d;
+		body2d->apply_force(force[i] * body2d->mass);
+	}
+	for (auto c = 0; c < n_chunks; c++)
+	{
+		for (auto& s : chunk_shots[c])
+		{
+			auto u = proxies[s.idx];
+			create_bullet(pos[s.idx] + s.dir * radius[s.idx], s.dir * 100.f, element_types[s.idx], u->player);
+		}
+	}
 }
 
-cBullet* create_bullet(const vec2& pos, const vec2& velocity, ElementType element_type, cPlayer* player)
+// bullets aren't physics bodies, they move in a straight line and sweep against units and the buildings of the tiles they cross
+void update_bullets()
+{
+	for (auto b : bullet_pool.actives)
+	{
+		auto p0 = b->element->pos;
+		auto p1 = p0 + b->velocity * delta_time;
+
+		auto t = 2.f;
+		ContactEvent ev;
+		ev.bullet = b;
+		if (auto u = unit_grid.sweep_enemy(p0, p1, b->radius, b->player_id, t); u != -1)
+		{
+			ev.target_kind = ContactUnit;
+			ev.target = unit_store.proxies[u];
+		}
+		// walk the tiles along the segment in quarter tile steps, so long steps (-step=) don't skip a building
+		auto n_samples = max(1, (int)ceil(length(p1 - p0) / (tile_sz * 0.25f)));
+		auto last_coord = ivec2(-1);
+		for (auto i = 0; i <= n_samples; i++)
+		{
+			auto coord = tile_coord_at(mix(p0, p1, (float)i / n_samples));
+			if (coord == last_coord)
+				continue;
+			last_coord = coord;
+			auto tile = get_tile(coord.x, coord.y);
+			if (!tile || !tile->building || tile->building->player->id == b->player_id)
+				continue;
+			auto building_t = 0.f;
+			if (sweep_circle(p0, p1, tile->pos, b->radius, building_t) && building_t < t)
+			{
+				t = building_t;
+				ev.target_kind = ContactBuilding;
+				ev.target = tile->building;
+			}
+		}
+		if (t <= 1.f)
+			contact_events.push_back(ev);
+
+		b->element->set_pos(p1);
+		b->ttl -= delta_time;
+		if (b->ttl <= 0.f)
+			b->dead = true;
+	}
+}
+
+cBullet* new_bullet(cPlayer* player)
 {
-	auto color = get_element_color(element_type);
 	auto e = Entity::create();
 	auto element = e->add_component<cElement>();
-	element->pos = pos;
 	element->ext = vec2(2.f);
 	element->pivot = vec2(0.5f);
 	auto image = e->add_component<cImage>();
 	image->image = img_sprite;
-	image->tint_col = color;
-	auto body2d = e->add_component<cBody2d>();
-	body2d->shape_type = physics::ShapeCircle;
-	body2d->radius = element->ext.x * 0.5f;
-	body2d->friction = 0.f;
-	body2d->collide_bit = 1 << player->id;
-	body2d->collide_mask = ~(body2d->collide_bit);
 	auto b = new cBullet;
 	b->element = element;
-	b->body2d = body2d;
+	b->radius = element->ext.x * 0.5f;
 	b->player_id = player->id;
+	e->add_component_p(b);
+	e->set_enable(false);
+	e_bullets_root->add_child(e);
+	bullet_pool.allocated++;
+	return b;
+}
+
+cBullet* BulletPool::acquire(cPlayer* player)
+{
+	if (free_lists.size() <= player->id)
+		free_lists.resize(player->id + 1);
+	auto& free_list = free_lists[player->id];
+	cBullet* b = nullptr;
+	if (!free_list.empty())
+	{
+		b = free_list.back();
+		free_list.pop_back();
+		reused++;
+	}
+	else
+		b = new_bullet(player);
+	b->pool_idx = actives.size();
+	actives.push_back(b);
+	high_water_mark = max(high_water_mark, (uint)actives.size());
+	return b;
+}
+
+void BulletPool::release(cBullet* b)
+{
+	b->entity->set_enable(false);
+	auto idx = b->pool_idx;
+	swap_pop(actives, idx);
+	if (idx < actives.size())
+		actives[idx]->pool_idx = idx;
+	free_lists[b->player_id].push_back(b);
+}
+
+void BulletPool::reserve(cPlayer* player, uint n)
+{
+	if (free_lists.size() <= player->id)
+		free_lists.resize(player->id + 1);
+	auto& free_list = free_lists[player->id];
+	while (free_list.size() < n)
+		free_list.push_back(new_bullet(player));
+}
+
+cBullet* create_bullet(const vec2& pos, const vec2& velocity, ElementType element_type, cPlayer* player)
+{
+	auto color = get_element_color(element_type);
+	auto b = bullet_pool.acquire(player);
+	b->element->set_pos(pos);
+	b->entity->get_component<cImage>()->tint_col = color;
 	b->id = bullet_id++;
 	b->color = color;
+	b->dead = false;
+	b->ttl = 2.f;
 	b->element_type = element_type;
-	if (player->tech_ignite->completed)
+	for (auto i = 0; i < StatusCount; i++)
+		b->status_values[i] = 0.f;
+	if (player->has_tech(tech_ignite))
 		b->status_values[StatusIgnited] = 20.f;
 	b->velocity = velocity;
-	e->add_component_p(b);
-	e_bullets_root->add_child(e);
+	b->entity->set_enable(true);
 
-	sound_shot->play();
+	audio_mixer.post(sound_shot, pos);
 
 	return b;
 }
 
+void update_border_mask(Tile* tile)
+{
+	uchar mask = 0;
+	if (auto city = tile->owner_city; city)
+	{
+		for (auto i = 0; i < 6; i++)
+		{
+			auto aj = tile->get_neighbor(tile_edge_directions[i]);
+			if (!aj || aj->owner_city != city)
+				mask |= 1 << i;
+		}
+		if (mask != tile->border_mask)
+			city->player->border_dirty = true;
+	}
+	tile->border_mask = mask;
+}
+
+void cCity::add_territory(Tile* tile)
+{
+	auto old_city = tile->owner_city;
+	if (old_city == this)
+		return;
+	if (old_city)
+	{
+		auto idx = tile->territory_idx;
+		swap_pop(old_city->territories, idx);
+		if (idx < old_city->territories.size())
+			old_city->territories[idx]->territory_idx = idx;
+		old_city->player->border_dirty = true;
+	}
+	tile->owner_city = this;
+	tile->territory_idx = territories.size();
+	territories.push_back(tile);
+	player->border_dirty = true;
+
+	update_border_mask(tile);
+	for (auto aj : tile->get_adjacent())
+		update_border_mask(aj);
+}
+
 void cPlayer::update()
 {
-	auto researching = get_researching();
-	while (science > 0 && researching)
+	PhaseScope scope(PhaseEconomy);
+
+	if (border_dirty)
+		update_border_lines();
+
+	while (science > 0 && researching != -1)
 	{
-		researching->value_change = 0;
+		auto& t = techs[researching];
+		auto need_value = tech_infos[researching].need_value;
+		t.value_change = 0;
 
 		if (sig_one_sec)
 		{
-			researching->value_avg = researching->value_one_sec_accumulate;
-			researching->value_one_sec_accumulate = 0;
+			t.value_avg = t.value_one_sec_accumulate;
+			t.value_one_sec_accumulate = 0;
 		}
 
-		auto s = min(science, researching->need_value - researching->value);
-		researching->value_change = s;
-		researching->value += researching->value_change;
-		researching->value_one_sec_accumulate += s;
+		auto s = min(science, need_value - t.value);
+		t.value_change = s;
+		t.value += t.value_change;
+		t.value_one_sec_accumulate += s;
 
-		if (researching->value >= researching->need_value)
+		science -= s;
+
+		if (t.value >= need_value)
 		{
-			researching->completed = true;
-			researching->researching = false;
+			t.completed = true;
+			t.researching = false;
+			for (auto& c : cities->children)
+				c->get_component<cCity>()->yields_dirty = true;
+			update_researching();
 		}
-
-		science -= s;
-		researching = get_researching();
 	}
 
 	science = science_next_turn;
@@ -1324,13 +3061,12 @@ void cPlayer::update()
 	science_next_turn += 10; // from ??
 }
 
-cBuilding* cPlayer::add_building(cCity* city, BuildingType type, cTile* tile)
+cBuilding* cPlayer::add_building(cCity* city, BuildingType type, Tile* tile)
 {
-	cBuilding* building = nullptr;
 	auto& info = building_infos[type];
 	auto e = Entity::create();
 	auto element = e->add_component<cElement>();
-	element->pos = tile->element->pos;
+	element->pos = tile->pos;
 	if (city)
 	{
 		element->pos -= city->element->pos;
@@ -1343,120 +3079,25 @@ cBuilding* cPlayer::add_building(cCity* city, BuildingType type, cTile* tile)
 	element_content->ext = vec2(tile_sz) * 0.6f;
 	e->add_child(e_content);
 	auto image = e_content->add_component<cImage>();
-	image->image = info.image ? info.image : img_building;
-	auto body2d = e->add_component<cBody2d>();
-	body2d->type = physics::BodyStatic;
-	body2d->shape_type = physics::ShapeCircle;
-	body2d->radius = element->ext.x * 0.5f;
-	body2d->radius = 0.f;
-	body2d->friction = 0.3f;
-	body2d->collide_bit = 1 << id;
-	switch (type)
-	{
-	case BuildingConstruction:
-	{
-		element->ext *= 0.7f;
-		auto movie = e->add_component<cMovie>();
-		movie->images.push_back(img_hammer1->desc());
-		movie->images.push_back(img_hammer2->desc());
-		movie->speed = 0.25f;
-		auto b = new cConstruction;
-		b->hp = 0;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		if (this == main_player)
-			sound_construction_begin->play();
-
-		building = b;
-	}
-		break;
-	case BuildingCity:
-	{
-		auto b = new cCity;
-		e->add_component_p(b);
-
-		b->add_territory(tile);
-		for (auto aj : tile->get_adjacent())
-			b->add_territory(aj);
-		cities->add_child(e);
-		update_border_lines();
-
-		building = b;
-	}
-		break;
-	case BuildingElementCollector:
-	{
-		auto b = new cElementCollector;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingFireBarracks:
-	{
-		auto b = new cFireBarracks;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingWaterBarracks:
-	{
-		auto b = new cWaterBarracks;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingGrassBarracks:
-	{
-		auto b = new cGrassBarracks;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingSteamMachine:
-	{
-		auto b = new cSteamMachine;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingWaterWheel:
-	{
-		auto b = new cWaterWheel;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	case BuildingFarm:
-	{
-		auto b = new cFarm;
-		e->add_component_p(b);
-		city->buildings->add_child(e);
-
-		building = b;
-	}
-		break;
-	}
+	image->image = info.image.get() ? info.image.get() : img_building;
+	auto it = building_classes.find(info.component);
+	auto building = it != building_classes.end() ? it->second() : new cBuilding;
+	e->add_component_p(building);
 	building->player = this;
 	building->city = city;
 	building->tile = tile;
 	building->type = type;
 	building->hp_max = info.hp_max;
-	if (building->hp > 0)
-		building->hp = info.hp_max;
+	building->hp = info.hp_max;
+	building->on_added();
+	if (city)
+		city->buildings->add_child(e);
+	else
+		cities->add_child(e);
 	tile->building = building;
+	if (city)
+		city->scheduler.add(building);
+	mark_yields_dirty(tile);
 	return building;
 }
 
@@ -1469,8 +3110,8 @@ cUnit* cPlayer::add_unit(const vec2& pos, UnitType type)
 	element->ext = vec2(tile_sz * 0.3f);
 	element->pivot = vec2(0.5f);
 	auto image = e->add_component<cImage>();
-	image->image = info.image ? info.image : img_sprite;
-	if (!info.image)
+	image->image = info.image.get() ? info.image.get() : img_sprite;
+	if (!info.image.get())
 		image->tint_col = get_element_color(info.element_type);
 	auto body2d = e->add_component<cBody2d>();
 	body2d->shape_type = physics::ShapeCircle;
@@ -1483,40 +3124,34 @@ cUnit* cPlayer::add_unit(const vec2& pos, UnitType type)
 	c->player = this;
 	c->id = unit_id++;
 	c->color = color;
-	c->element_type = info.element_type;
-	c->hp_max = info.hp_max;
-	c->hp = info.hp_max;
+	c->idx = unit_store.add(c, id, info.element_type, info.hp_max, pos);
 	e->add_component_p(c);
 	e_units_root->add_child(e);
 	return c;
 }
 
-cTile* hovering_tile = nullptr;
-cTile* selecting_tile = nullptr;
+Tile* hovering_tile = nullptr;
+Tile* selecting_tile = nullptr;
 float select_tile_time = 0.f;
+bool mouse_over_tiles = false;
 
-void on_contact(EntityPtr a, EntityPtr b)
+void resolve_contacts()
 {
-	cUnit* character = nullptr;
-	cBuilding* building = nullptr;
-	cBullet* bullet = nullptr;
-	character = a->get_component<cUnit>();
-	building = a->get_base_component<cBuilding>();
-	bullet = b->get_component<cBullet>();
-	if ((!character && !building) || !bullet)
-	{
-		character = b->get_component<cUnit>();
-		building = b->get_base_component<cBuilding>();
-		bullet = a->get_component<cBullet>();
-	}
-	if ((!character && !building) || !bullet)
-		return;
+	PhaseScope scope(PhaseContacts);
 
-	auto hit = false;
-	if (character)
+	for (auto& ev : contact_events)
 	{
-		if (character->player->id != bullet->player_id)
+		auto bullet = ev.bullet;
+		// a bullet only hits once, the first contact of the step wins
+		if (bullet->dead)
+			continue;
+		switch (ev.target_kind)
+		{
+		case ContactUnit:
 		{
+			auto character = (cUnit*)ev.target;
+			if (character->player->id == bullet->player_id || unit_store.dead[character->idx])
+				break;
 			bullet->dead = true;
 			character->take_damage(bullet->element_type, 10);
 			for (auto i = 0; i < StatusCount; i++)
@@ -1524,36 +3159,38 @@ void on_contact(EntityPtr a, EntityPtr b)
 				if (auto v = bullet->status_values[i]; v > 0.f)
 					character->take_status_value((StatusType)i, v);
 			}
-
-			hit = true;
+			audio_mixer.post(sound_hit, bullet->element->pos);
 		}
-	}
-	if (building)
-	{
-		if (building->player->id != bullet->player_id)
+			break;
+		case ContactBuilding:
 		{
+			auto building = (cBuilding*)ev.target;
+			if (building->player->id == bullet->player_id || building->dead)
+				break;
 			bullet->dead = true;
 			building->hp -= 1;
 			if (building->hp <= 0)
 				building->dead = true;
-
-			hit = true;
+			audio_mixer.post(sound_hit, bullet->element->pos);
+		}
+			break;
 		}
 	}
-	if (hit)
-		sound_hit->play();
+	contact_events.clear();
 }
 
-std::function<void(cTile*)> select_tile_callback;
-bool begin_select_tile(const std::function<bool(cTile*)>& candidater, const std::function<void(cTile*)>& callback)
+std::function<void(Tile*)> select_tile_callback;
+std::vector<Tile*> highlighted_tiles;
+// 'candidates' is the precomputed set the selection can come from, only those are tested and highlighted
+bool begin_select_tile(const std::vector<Tile*>& candidates, const std::function<bool(Tile*)>& candidater, const std::function<void(Tile*)>& callback)
 {
 	auto n = 0;
-	for (auto& t : e_tiles_root->children)
+	for (auto tile : candidates)
 	{
-		auto tile = t->get_component<cTile>();
-		if (candidater(tile))
+		if (!tile->highlighted && candidater(tile))
 		{
 			tile->highlighted = true;
+			highlighted_tiles.push_back(tile);
 			n++;
 		}
 	}
@@ -1562,90 +3199,284 @@ bool begin_select_tile(const std::function<bool(cTile*)>& candidater, const std:
 	return n > 0;
 }
 
-void end_select_tile(cTile* tile)
+void end_select_tile(Tile* tile)
 {
 	if (tile)
 		select_tile_callback(tile);
 	select_tile_callback = nullptr;
 
-	for (auto& t : e_tiles_root->children)
+	for (auto tile : highlighted_tiles)
+	{
+		if (!headless)
+			tile_mesh.set_tint(tile, cvec4(255));
+		tile->highlighted = false;
+	}
+	highlighted_tiles.clear();
+}
+
+// pulses the candidates while a tile selection is going on
+void update_tile_highlights()
+{
+	if (!select_tile_callback)
+		return;
+	auto v = clamp(sin(fract(total_time) * pi<float>()) * 0.25f + 0.25f, 0.f, 1.f);
+	for (auto tile : highlighted_tiles)
+		tile_mesh.set_tint(tile, cvec4(cvec3(v * 255.f), 255));
+}
+
+void execute_command(const Command& c)
+{
+	if (c.player >= e_players_root->children.size())
+		return;
+	auto player = e_players_root->children[c.player]->get_component<cPlayer>();
+	switch (c.type)
+	{
+	case CommandConstruct:
+	{
+		if (c.tile >= count_of(tile_map) || c.city_tile >= count_of(tile_map) || c.value >= building_infos.size())
+			break;
+		auto tile = &tile_map[c.tile];
+		auto city = tile_map[c.city_tile].owner_city;
+		if (tile->building || !city || city->player != player)
+			break;
+		auto construction = (cConstruction*)player->add_building(city, BuildingConstruction, tile);
+		construction->construct_building = (BuildingType)c.value;
+	}
+		break;
+	case CommandResearch:
+		if (c.value < tech_infos.size())
+			player->start_researching(c.value);
+		break;
+	case CommandSetBuildingEnable:
+		if (c.tile < count_of(tile_map))
+		{
+			auto building = tile_map[c.tile].building;
+			if (building && building->player == player)
+				building->set_building_enable(c.value != 0);
+		}
+		break;
+	case CommandSetMassProduction:
+		mass_production = c.value != 0;
+		break;
+	}
+}
+
+// player orders are applied at the start of a frame so that replays see them at the same point
+void execute_commands()
+{
+	if (replaying)
+	{
+		while (replay_cursor < replay_commands.size() && replay_commands[replay_cursor].frame <= sim_frame)
+			execute_command(replay_commands[replay_cursor++]);
+		return;
+	}
+	for (auto& c : pending_commands)
+	{
+		c.frame = sim_frame;
+		execute_command(c);
+		if (replay_out.is_open())
+			replay_out.write((char*)&c, sizeof(c));
+	}
+	pending_commands.clear();
+}
+
+struct BenchmarkScenario
+{
+	const char* name;
+	uint players;
+	uint units;
+	uint cities_per_player;
+	bool fill_barracks;
+};
+
+BenchmarkScenario benchmark_scenarios[] = {
+	{ "2p_1k", 2, 1000, 1, false },
+	{ "2p_10k", 2, 10000, 1, false },
+	{ "8p_10k", 8, 10000, 1, false },
+	{ "8p_50k", 8, 50000, 1, false },
+	{ "8p_cities", 8, 0, 6, true },
+	{ "8p_cities_10k", 8, 10000, 6, true }
+};
+const BenchmarkScenario* benchmark_scenario = nullptr;
+
+void setup_benchmark_scenario()
+{
+	auto& sc = *benchmark_scenario;
+	auto cols = min(sc.players, 4U);
+	auto rows = (sc.players + cols - 1) / cols;
+	for (auto i = 0; i < sc.players; i++)
+	{
+		auto x = int((i % cols + 0.5f) * tile_cx / cols);
+		auto y = int((i / cols + 0.5f) * tile_cy / rows);
+		auto player = add_player(get_tile(x, y));
+		player->ai = true;
+		if (i == 0)
+			main_player = player;
+
+		auto capital = get_tile(x, y);
+		auto& ring = get_hex_ring(4);
+		for (auto j = 1; j < sc.cities_per_player; j++)
+		{
+			auto c = axial_to_offset(capital->axial() + ring[(j - 1) * ring.size() / (sc.cities_per_player - 1)]);
+			auto tile = get_tile(c.x, c.y);
+			if (tile && !tile->owner_city)
+				player->add_building(nullptr, BuildingCity, tile);
+		}
+
+		if (sc.fill_barracks)
+		{
+			for (auto& c : player->cities->children)
+			{
+				auto city = c->get_component<cCity>();
+				for (auto tile : city->territories)
+				{
+					if (tile->building)
+						continue;
+					switch (tile->element_type)
+					{
+					case ElementFire: player->add_building(city, BuildingFireBarracks, tile); break;
+					case ElementWater: player->add_building(city, BuildingWaterBarracks, tile); break;
+					case ElementGrass: player->add_building(city, BuildingGrassBarracks, tile); break;
+					}
+				}
+			}
+		}
+
+		auto n = sc.units / sc.players;
+		for (auto j = 0; j < n; j++)
+		{
+			auto dx = rng_spawn.range(-1.f, +1.f);
+			auto dy = rng_spawn.range(-1.f, +1.f);
+			player->add_unit(capital->pos + vec2(dx, dy) * tile_sz * 3.f, (UnitType)(j % unit_infos.size()));
+		}
+	}
+}
+
+// the assets loaded before the first frame, the prefetch list and the progress counts come from these tables
+struct StartupImage
+{
+	const wchar_t* path;
+	graphics::ImagePtr* image;
+};
+
+StartupImage startup_images[] = {
+	{ L"assets/tile.png", &img_tile },
+	{ L"assets/tile_select.png", &img_tile_select },
+	{ L"assets/building.png", &img_building },
+	{ L"assets/hammer1.png", &img_hammer1 },
+	{ L"assets/hammer2.png", &img_hammer2 },
+	{ L"assets/sprite.png", &img_sprite },
+	{ L"assets/food.png", &img_food },
+	{ L"assets/population.png", &img_population },
+	{ L"assets/production.png", &img_production },
+	{ L"assets/science.png", &img_science },
+	{ L"assets/frame.png", &img_frame },
+	{ L"assets/frame2.png", &img_frame2 },
+	{ L"assets/button.png", &img_button }
+};
+
+struct StartupSound
+{
+	const wchar_t* path;
+	float volumn;
+	audio::SourcePtr* sound;
+};
+
+StartupSound startup_sounds[] = {
+	{ L"assets/hover.wav", 0.15f, &sound_hover },
+	{ L"assets/clicked.wav", 0.35f, &sound_clicked },
+	{ L"assets/construction_begin.wav", 0.35f, &sound_construction_begin },
+	{ L"assets/construction_end.wav", 0.35f, &sound_construction_end },
+	{ L"assets/shot.wav", 0.15f, &sound_shot },
+	{ L"assets/hit.wav", 0.2f, &sound_hit }
+};
+
+void Game::init()
+{
+	init_begin_time = std::chrono::steady_clock::now();
+	if (!headless)
+	{
+		std::vector<std::filesystem::path> paths;
+		for (auto& i : startup_images)
+			paths.push_back(i.path);
+		for (auto& s : startup_sounds)
+			paths.push_back(s.path);
+		file_prefetcher.start(std::move(paths), 4);
+	}
+
+	if (headless)
+	{
+		// no window and no graphics device, just the world that runs the components, with the systems the
+		// simulation relies on: scene for the unit bodies' physics and tween for the building animations
+		world.reset(World::create());
+		world->add_system(th<sScene>());
+		world->add_system(th<sTween>());
+	}
+	else
 	{
-		auto tile = t->get_component<cTile>();
-		tile->highlighted = false;
+		UniverseApplicationOptions app_options;
+		app_options.graphics_debug = true;
+		app_options.graphics_configs = { {"mesh_shader"_h, 0} };
+		create("Elemental Wars", uvec2(1280, 720), WindowStyleFrame | WindowStyleResizable, app_options);
 	}
-}
-
-void Game::init()
-{
-	srand(time(0));
-
-	UniverseApplicationOptions app_options;
-	app_options.graphics_debug = true;
-	app_options.graphics_configs = { {"mesh_shader"_h, 0} };
-	create("Elemental Wars", uvec2(1280, 720), WindowStyleFrame | WindowStyleResizable, app_options);
 
 	Path::set_root(L"assets", L"assets");
 
-	ui_canvas = hud->canvas;
-
-	img_tile = graphics::Image::get(L"assets/tile.png");
-	atlas_tiles = graphics::ImageAtlas::get(L"assets/tiles.png");
-	img_fire_tile = atlas_tiles->get_item("fire_tile"_h);
-	img_water_tile = atlas_tiles->get_item("water_tile"_h);
-	img_grass_tile = atlas_tiles->get_item("grass_tile"_h);
-	img_tile_select = graphics::Image::get(L"assets/tile_select.png");
-	img_building = graphics::Image::get(L"assets/building.png");
-	img_hammer1 = graphics::Image::get(L"assets/hammer1.png");
-	img_hammer2 = graphics::Image::get(L"assets/hammer2.png");
-	img_sprite = graphics::Image::get(L"assets/sprite.png");
-	img_food = graphics::Image::get(L"assets/food.png");
-	img_population = graphics::Image::get(L"assets/population.png");
-	img_production = graphics::Image::get(L"assets/production.png");
-	img_science = graphics::Image::get(L"assets/science.png");
-	img_frame = graphics::Image::get(L"assets/frame.png");
-	img_frame_desc = img_frame->desc_with_config();
-	img_frame2 = graphics::Image::get(L"assets/frame2.png");
-	img_frame2_desc = img_frame2->desc_with_config();
-	img_button = graphics::Image::get(L"assets/button.png");
-	img_button_desc = img_button->desc_with_config();
-
-	auto sp3 = graphics::Sampler::get(graphics::FilterLinear, graphics::FilterLinear, true, graphics::AddressClampToEdge);
-
-	ui_canvas->register_ch_color(ch_color_white, cvec4(255, 255, 255, 255));
-	ui_canvas->register_ch_color(ch_color_black, cvec4(0, 0, 0, 255));
-	ui_canvas->register_ch_color(ch_color_yes, cvec4(72, 171, 90, 255));
-	ui_canvas->register_ch_color(ch_color_no, cvec4(191, 102, 116, 255));
-	for (auto i = 0; i < ElementCount; i++)
-		ui_canvas->register_ch_color(ch_color_elements[i], get_element_color((ElementType)i));
-	ui_canvas->register_ch_size(ch_size_small, 16);
-	ui_canvas->register_ch_size(ch_size_medium, 20);
-	ui_canvas->register_ch_size(ch_size_big, 24);
-	ui_canvas->register_ch_icon(ch_icon_tile, img_tile->desc());
-	ui_canvas->register_ch_icon(ch_icon_food, img_food->desc());
-	ui_canvas->register_ch_icon(ch_icon_population, img_population->desc());
-	ui_canvas->register_ch_icon(ch_icon_production, img_production->desc());
-	ui_canvas->register_ch_icon(ch_icon_science, img_science->desc());
-
-	hud->push_style_var(HudStyleVarWindowFrame, vec4(1.f, 0.f, 0.f, 0.f));
-	hud->push_style_sound(HudStyleSoundButtonHover, sound_hover);
-	hud->push_style_sound(HudStyleSoundButtonClicked, sound_clicked);
-
-	//hud->push_style_var(HudStyleVarButtonBorder, img_button_desc.border_uvs * vec2(img_button->extent).xyxy() * 0.3f);
-	//hud->push_style_color(HudStyleColorButton, cvec4(255, 255, 255, 255));
-	//hud->push_style_color(HudStyleColorButtonHovered, cvec4(200, 200, 200, 255));
-	//hud->push_style_color(HudStyleColorButtonActive, cvec4(220, 220, 220, 255));
-	//hud->push_style_color(HudStyleColorButtonDisabled, cvec4(255, 255, 255, 255));
-	//hud->push_style_image(HudStyleImageButton, img_button_desc);
-	//hud->push_style_image(HudStyleImageButtonHovered, img_button_desc);
-	//hud->push_style_image(HudStyleImageButtonActive, img_button_desc);
-	//hud->push_style_image(HudStyleImageButtonDisabled, img_button_desc);
-
-	sound_hover = load_sound_effect(L"assets/hover.wav", 0.15f);
-	sound_clicked = load_sound_effect(L"assets/clicked.wav", 0.35f);
-	sound_construction_begin = load_sound_effect(L"assets/construction_begin.wav", 0.35f);
-	sound_construction_end = load_sound_effect(L"assets/construction_end.wav", 0.35f);
-	sound_shot = load_sound_effect(L"assets/shot.wav", 0.15f);
-	sound_hit = load_sound_effect(L"assets/hit.wav", 0.2f);
+	graphics::SamplerPtr sp3 = nullptr;
+	if (!headless)
+	{
+		ui_canvas = hud->canvas;
+
+		for (auto& i : startup_images)
+			*i.image = load_image(i.path);
+		atlas_tiles = graphics::ImageAtlas::get(L"assets/tiles.png");
+		img_fire_tile = atlas_tiles->get_item("fire_tile"_h);
+		img_water_tile = atlas_tiles->get_item("water_tile"_h);
+		img_grass_tile = atlas_tiles->get_item("grass_tile"_h);
+		img_frame_desc = img_frame->desc_with_config();
+		img_frame2_desc = img_frame2->desc_with_config();
+		img_button_desc = img_button->desc_with_config();
+		report_load_progress("images", count_of(startup_images));
+
+		sp3 = graphics::Sampler::get(graphics::FilterLinear, graphics::FilterLinear, true, graphics::AddressClampToEdge);
+
+		ui_canvas->register_ch_color(ch_color_white, cvec4(255, 255, 255, 255));
+		ui_canvas->register_ch_color(ch_color_black, cvec4(0, 0, 0, 255));
+		ui_canvas->register_ch_color(ch_color_yes, cvec4(72, 171, 90, 255));
+		ui_canvas->register_ch_color(ch_color_no, cvec4(191, 102, 116, 255));
+		for (auto i = 0; i < ElementCount; i++)
+			ui_canvas->register_ch_color(ch_color_elements[i], get_element_color((ElementType)i));
+		ui_canvas->register_ch_size(ch_size_small, 16);
+		ui_canvas->register_ch_size(ch_size_medium, 20);
+		ui_canvas->register_ch_size(ch_size_big, 24);
+		ui_canvas->register_ch_icon(ch_icon_tile, img_tile->desc());
+		ui_canvas->register_ch_icon(ch_icon_food, img_food->desc());
+		ui_canvas->register_ch_icon(ch_icon_population, img_population->desc());
+		ui_canvas->register_ch_icon(ch_icon_production, img_production->desc());
+		ui_canvas->register_ch_icon(ch_icon_science, img_science->desc());
+
+		hud->push_style_var(HudStyleVarWindowFrame, vec4(1.f, 0.f, 0.f, 0.f));
+		hud->push_style_sound(HudStyleSoundButtonHover, sound_hover);
+		hud->push_style_sound(HudStyleSoundButtonClicked, sound_clicked);
+
+		//hud->push_style_var(HudStyleVarButtonBorder, img_button_desc.border_uvs * vec2(img_button->extent).xyxy() * 0.3f);
+		//hud->push_style_color(HudStyleColorButton, cvec4(255, 255, 255, 255));
+		//hud->push_style_color(HudStyleColorButtonHovered, cvec4(200, 200, 200, 255));
+		//hud->push_style_color(HudStyleColorButtonActive, cvec4(220, 220, 220, 255));
+		//hud->push_style_color(HudStyleColorButtonDisabled, cvec4(255, 255, 255, 255));
+		//hud->push_style_image(HudStyleImageButton, img_button_desc);
+		//hud->push_style_image(HudStyleImageButtonHovered, img_button_desc);
+		//hud->push_style_image(HudStyleImageButtonActive, img_button_desc);
+		//hud->push_style_image(HudStyleImageButtonDisabled, img_button_desc);
+	}
+
+	for (auto& s : startup_sounds)
+		*s.sound = load_sound_effect(s.path, s.volumn);
+	audio_mixer.add_channel(sound_shot, 4, 0.1f);
+	audio_mixer.add_channel(sound_hit, 4, 0.1f);
+	if (!headless)
+		report_load_progress("sounds", count_of(startup_sounds));
+	file_prefetcher.finish();
 
 	{
 		auto effectiveness = element_effectiveness[ElementFire];
@@ -1666,78 +3497,9 @@ void Game::init()
 		effectiveness[ElementGrass] = 1.f;
 	}
 
-	building_infos[BuildingCity] = {
-		.name = L"City",
-		.need_production = 1,
-		.hp_max = 15000
-	};
-	building_infos[BuildingConstruction] = {
-		.name = L"Construction"
-	};
-	building_infos[BuildingFireTower] = {
-		.name = L"Element Collector"
-	};
-	building_infos[BuildingFireTower] = {
-		.name = L"Fire Tower"
-	};
-	building_infos[BuildingWaterTower] = {
-		.name = L"Water Tower"
-	};
-	building_infos[BuildingGrassTower] = {
-		.name = L"Grass Tower"
-	};
-	building_infos[BuildingFireBarracks] = {
-		.name = L"Fire Barracks",
-		.description = std::format(L"Produce Fire Elemental"),
-		.require_tile_type = ElementFire,
-		.image = graphics::Image::get(L"assets/fire_barracks.png")
-	};
-	building_infos[BuildingWaterBarracks] = {
-		.name = L"Water Barracks",
-		.description = std::format(L"Produce Water Elemental"),
-		.require_tile_type = ElementWater,
-		.image = graphics::Image::get(L"assets/water_barracks.png")
-	};
-	building_infos[BuildingGrassBarracks] = {
-		.name = L"Grass Barracks",
-		.description = std::format(L"Produce Grass Elemental"),
-		.require_tile_type = ElementGrass,
-		.image = graphics::Image::get(L"assets/grass_barracks.png")
-	};
-	building_infos[BuildingSteamMachine] = {
-		.name = L"Steam Machine",
-		.description = std::format(L"Provide Production\n+2{}{}{}", ch_color_white, ch_icon_production, ch_color_end),
-		.require_tile_type = ElementFire,
-		.image = graphics::Image::get(L"assets/steam_machine.png")
-	};
-	building_infos[BuildingWaterWheel] = {
-		.name = L"Water Wheel",
-		.description = std::format(L"Provide Production\n+2{}{}{}", ch_color_white, ch_icon_production, ch_color_end),
-		.require_tile_type = ElementWater,
-		.image = graphics::Image::get(L"assets/water_wheel.png")
-	};
-	building_infos[BuildingFarm] = {
-		.name = L"Farm",
-		.description = std::format(L"Provide Food\n+2{}{}{}", ch_color_white, ch_icon_food, ch_color_end),
-		.require_tile_type = ElementGrass,
-		.image = graphics::Image::get(L"assets/farm.png")
-	};
-
-	unit_infos[UnitFireElemental] = {
-		.name = L"Fire Elemental",
-		.element_type = ElementFire,
-		.image = graphics::Image::get(L"assets/fire_elemental.png")
-	};
-	unit_infos[UnitWaterElemental] = {
-		.name = L"Water Elemental",
-		.element_type = ElementWater,
-		.image = graphics::Image::get(L"assets/water_elemental.png")
-	};
-	unit_infos[UnitGrassElemental] = {
-		.name = L"Grass Elemental",
-		.element_type = ElementGrass,
-		.image = graphics::Image::get(L"assets/grass_elemental.png")
-	};
+	register_building_classes();
+	load_catalogs(L"assets/buildings.xml", L"assets/units.xml", L"assets/catalog.cache");
+	load_tech_infos(L"assets/techs.xml");
 
 	auto root = world->root.get();
 
@@ -1754,127 +3516,89 @@ void Game::init()
 	}
 
 	e_tiles_root = Entity::create();
-	e_tiles_root->add_component<cElement>();
-	e_element_root->add_child(e_tiles_root);
-	auto stage_sz = vec2(tile_cx * tile_sz * 0.75f, tile_cy * tile_sz_y);
-	for (auto y = 0; y < tile_cy; y++)
 	{
-		for (auto x = 0; x < tile_cx; x++)
-		{
-			auto id = y * tile_cx + x;
-			auto e = Entity::create();
-			auto element = e->add_component<cElement>();
-			element->pos = vec2(x * tile_sz * 0.75f, y * tile_sz_y);
-			if (x % 2 == 1)
-				element->pos.y += tile_sz_y * 0.5f;
-			element->ext = vec2(tile_sz, tile_sz_y);
-			element->pivot = vec2(0.5f);
-			auto polygon = e->add_component<cPolygon>();
-			polygon->image = atlas_tiles->image;
-			polygon->sampler = sp3;
-			auto tile = new cTile;
-			tile->element = element;
-			tile->polygon = polygon;
-			tile->id = id;
-			e->add_component_p(tile);
-			vec4 uvs;
-			switch (linearRand(0, 2))
+		// one receiver covers the whole map, the hex under the mouse is picked analytically
+		auto element = e_tiles_root->add_component<cElement>();
+		element->ext = vec2((tile_cx - 1) * tile_sz * 0.75f + tile_sz, (tile_cy + 0.5f) * tile_sz_y); // odd columns reach half a tile lower
+		element->pivot = vec2(tile_sz * 0.5f, tile_sz_y * 0.5f) / element->ext;
+		auto receiver = e_tiles_root->add_component<cReceiver>();
+		receiver->event_listeners.add([this](uint type, const vec2& value) {
+			switch (type)
 			{
-			case 0:
-				uvs = img_fire_tile.uvs;
-				tile->element_type = ElementFire; 
+			case "mouse_enter"_h:
+				mouse_over_tiles = true;
 				break;
-			case 1:
-				uvs = img_water_tile.uvs;
-				tile->element_type = ElementWater; 
+			case "mouse_leave"_h:
+				mouse_over_tiles = false;
+				hovering_tile = nullptr;
 				break;
-			case 2:
-				uvs = img_grass_tile.uvs;
-				tile->element_type = ElementGrass; 
-				break;
-			}
-			auto uv0 = element->pos / stage_sz;
-			for (auto i = 0; i < 6; i++)
-			{
-				auto v = arc_point(vec2(0.f), i * 60.f, 1.f);
-				//polygon->add_pt(v * tile_sz * 0.5f, mix(uvs.xy(), uvs.zw(), fract(clamp(uv0 + (v * 0.5f + 0.5f) / vec2(tile_cx, tile_cy), vec2(0.001f), vec2(0.999f)) * 2.f)));
-				polygon->add_pt(v * tile_sz * 0.5f, mix(uvs.xy(), uvs.zw(), v * 0.5f + 0.5f));
-			}
-			auto receiver = e->add_component<cReceiver>();
-			receiver->event_listeners.add([tile](uint type, const vec2& value) {
-				switch (type)
+			case "click"_h:
+				if (auto tile = pick_tile(input->mpos); tile)
 				{
-				case "mouse_enter"_h:
-					hovering_tile = tile;
-					break;
-				case "mouse_leave"_h:
-					if (hovering_tile == tile)
-						hovering_tile = nullptr;
-					break;
-				case "click"_h:
 					if (select_tile_callback)
 						end_select_tile(tile);
 					else
 						selecting_tile = tile;
 					select_tile_time = total_time;
-					sound_hover->play();
-					break;
+					play_sound(sound_hover);
 				}
-			});
-			e_tiles_root->add_child(e);
-		}
+				break;
+			}
+		});
 	}
+	e_element_root->add_child(e_tiles_root);
 	for (auto y = 0; y < tile_cy; y++)
 	{
 		for (auto x = 0; x < tile_cx; x++)
 		{
 			auto id = y * tile_cx + x;
-			auto tile = e_tiles_root->children[id]->get_component<cTile>();
-
-			if (x % 2 == 0)
-			{
-				if (x > 0 && y > 0)
-					tile->tile_lt = e_tiles_root->children[id - tile_cx - 1]->get_component<cTile>();
-				if (x < tile_cx - 1 && y > 0)
-					tile->tile_rt = e_tiles_root->children[id - tile_cx + 1]->get_component<cTile>();
-				if (x > 0 && y < tile_cy - 1)
-					tile->tile_lb = e_tiles_root->children[id - 1]->get_component<cTile>();
-				if (x < tile_cx - 1 && y < tile_cy - 1)
-					tile->tile_rb = e_tiles_root->children[id + 1]->get_component<cTile>();
-			}
-			else
+			auto tile = &tile_map[id];
+			tile->pos = vec2(x * tile_sz * 0.75f, y * tile_sz_y);
+			if (x % 2 == 1)
+				tile->pos.y += tile_sz_y * 0.5f;
+			tile->id = id;
+			tile->coord = ivec2(x, y);
+			switch (rng_map.range(0, 2))
 			{
-				tile->tile_lt = e_tiles_root->children[id - 1]->get_component<cTile>();
-				if (x < tile_cx - 1)
-					tile->tile_rt = e_tiles_root->children[id + 1]->get_component<cTile>();
-				if (y < tile_cy - 1)
-					tile->tile_lb = e_tiles_root->children[id + tile_cx - 1]->get_component<cTile>();
-				if (x < tile_cx - 1 && y < tile_cy - 1)
-					tile->tile_rb = e_tiles_root->children[id + tile_cx + 1]->get_component<cTile>();
+			case 0: tile->element_type = ElementFire; break;
+			case 1: tile->element_type = ElementWater; break;
+			case 2: tile->element_type = ElementGrass; break;
 			}
-
-			if (y > 0)
-				tile->tile_t = e_tiles_root->children[id - tile_cx]->get_component<cTile>();
-			if (y < tile_cy - 1)
-				tile->tile_b = e_tiles_root->children[id + tile_cx]->get_component<cTile>();
 		}
 	}
-
+	if (!headless)
 	{
-		auto p0 = e_tiles_root->first_child()->get_component<cElement>()->pos + vec2(tile_sz) * 0.5f;
-		auto p1 = e_tiles_root->last_child()->get_component<cElement>()->pos + vec2(tile_sz) * 0.5f;
+		tile_mesh.image = atlas_tiles->image;
+		tile_mesh.sampler = sp3;
+		tile_mesh.init();
+		e_tiles_root->get_component<cElement>()->drawers.add([this](graphics::CanvasPtr ui_canvas) {
+			vec2 lt, rb;
+			camera_view_rect(lt, rb, tile_sz);
+			tile_mesh.draw(ui_canvas, lt, rb);
+		});
+	}
+	{
+		auto p0 = tile_map[0].pos + vec2(tile_sz) * 0.5f;
+		auto p1 = tile_map[count_of(tile_map) - 1].pos + vec2(tile_sz) * 0.5f;
 		camera->element->set_pos((p0 + p1) * 0.5f);
 		camera->restrict_lt = p0;
 		camera->restrict_rb = p1;
+		unit_grid.init(p0 - vec2(tile_sz), p1 + vec2(tile_sz));
 	}
 
 	e_players_root = Entity::create();
 	e_players_root->add_component<cElement>();
 	e_element_root->add_child(e_players_root);
 
-	main_player = add_player(e_tiles_root->children[int(tile_cx * 0.25f + tile_cy * 0.25f * tile_cx)]->get_component<cTile>());
-	auto opponent = add_player(e_tiles_root->children[int(tile_cx * 0.5f + tile_cy * 0.5f * tile_cx)]->get_component<cTile>());
-	opponent->ai = true;
+	if (benchmark_scenario)
+		setup_benchmark_scenario();
+	else
+	{
+		main_player = add_player(&tile_map[int(tile_cx * 0.25f + tile_cy * 0.25f * tile_cx)]);
+		auto opponent = add_player(&tile_map[int(tile_cx * 0.5f + tile_cy * 0.5f * tile_cx)]);
+		opponent->ai = true;
+		main_player->ai = main_player_ai;
+	}
 
 	{
 		auto e_layer = Entity::create();
@@ -1883,10 +3607,14 @@ void Game::init()
 			for (auto& p : e_players_root->children)
 			{
 				auto player = p->get_component<cPlayer>();
-				ui_canvas->path = player->border_lines;
-				ui_canvas->stroke(4.f, cvec4(255), false);
-				ui_canvas->path = player->border_lines;
-				ui_canvas->stroke(2.f, player->color, false);
+				for (auto& s : player->border_strips)
+				{
+					auto begin = player->border_verts.begin() + s.offset;
+					ui_canvas->path.assign(begin, begin + s.count);
+					ui_canvas->stroke(4.f, cvec4(255), s.closed);
+					ui_canvas->path.assign(begin, begin + s.count);
+					ui_canvas->stroke(2.f, player->color, s.closed);
+				}
 			}
 		});
 		e_element_root->add_child(e_layer);
@@ -1926,17 +3654,291 @@ void Game::init()
 	e_bullets_root = Entity::create();
 	e_bullets_root->add_component<cElement>();
 	e_element_root->add_child(e_bullets_root);
+	for (auto& p : e_players_root->children)
+		bullet_pool.reserve(p->get_component<cPlayer>(), bullet_pool.reserve_per_player);
+
+	{
+		auto e_layer = Entity::create();
+		auto element = e_layer->add_component<cElement>();
+		element->drawers.add([this](graphics::CanvasPtr ui_canvas) {
+			vec2 lt, rb;
+			camera_view_rect(lt, rb, tile_sz);
+			bar_overlay.draw(ui_canvas, lt, rb);
+		});
+		e_element_root->add_child(e_layer);
+	}
+
+	if (!headless)
+	{
+		auto rt = renderer->add_render_target(RenderMode2D, camera, main_window, {}, graphics::ImageLayoutPresent);
+		//rt->canvas->enable_clipping = true; // slower..
+	}
+}
+
+std::vector<float> phase_samples[PhaseCount + 1]; // per frame, the last one is the whole frame
+
+// the camera element sits at the view center, its scale is the zoom
+vec2 Game::screen_to_world(const vec2& screen_pos)
+{
+	return camera->element->pos + (screen_pos - vec2(ui_canvas->size) * 0.5f) / camera->element->scl.x;
+}
+
+// world rect seen by the camera, grown by 'margin' on every side, used for drawing, picking and audio culling
+void Game::camera_view_rect(vec2& lt, vec2& rb, float margin)
+{
+	lt = screen_to_world(vec2(0.f)) - vec2(margin);
+	rb = screen_to_world(vec2(ui_canvas->size)) + vec2(margin);
+}
+
+// screen position to tile through the camera transform, using the same layout as the tiles
+Tile* Game::pick_tile(const vec2& screen_pos)
+{
+	auto coord = tile_coord_at(screen_to_world(screen_pos));
+	if (coord.x < 0 || coord.y < 0 || coord.x >= tile_cx || coord.y >= tile_cy)
+		return nullptr;
+	return get_tile(coord.x, coord.y);
+}
+
+uint state_hash_every = 0;
+
+// hash of what the simulation produced (unit positions and hp, building hp, working state and animation scale),
+// printed every 'state_hash_every' frames so a headless run can be compared with a windowed one of the same seed/replay
+uint64_t sim_state_hash()
+{
+	auto h = 0xcbf29ce484222325ULL;
+	auto mix_in = [&](uint64_t v) {
+		h = (h ^ v) * 0x100000001b3ULL;
+	};
+	for (auto i = 0; i < unit_store.size(); i++)
+	{
+		if (unit_store.dead[i])
+			continue;
+		mix_in(unit_store.ids[i]);
+		mix_in((uint)(int)round(unit_store.pos[i].x * 16.f));
+		mix_in((uint)(int)round(unit_store.pos[i].y * 16.f));
+		mix_in(unit_store.hp[i]);
+	}
+	for (auto& p : e_players_root->children)
+	{
+		auto player = p->get_component<cPlayer>();
+		for (auto& c : player->cities->children)
+		{
+			for (auto& e : c->get_component<cCity>()->buildings->children)
+			{
+				auto b = e->get_base_component<cBuilding>();
+				mix_in(b->tile->id);
+				mix_in(b->hp);
+				mix_in(b->working);
+				if (b->e_content)
+					mix_in((uint)(int)round(b->e_content->get_component<cElement>()->scl.x * 1000.f));
+			}
+		}
+	}
+	return h;
+}
+
+float Game::step_headless(uint frames)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (auto i = 0; i < frames; i++)
+	{
+		auto frame_t0 = std::chrono::high_resolution_clock::now();
+		delta_time = fixed_step;
+		total_time += fixed_step;
+		if (!on_update())
+			break;
+		if (profiling)
+		{
+			for (auto j = 0; j < PhaseCount; j++)
+			{
+				phase_samples[j].push_back(phase_times[j]);
+				phase_times[j] = 0.f;
+			}
+			phase_samples[PhaseCount].push_back(std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - frame_t0).count());
+		}
+	}
+	return std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+void Game::run_headless(uint frames)
+{
+	auto wall_time = step_headless(frames);
+
+	auto n_cities = 0;
+	auto n_buildings = 0;
+	for (auto& p : e_players_root->children)
+	{
+		auto player = p->get_component<cPlayer>();
+		n_cities += player->cities->children.size();
+		for (auto& c : player->cities->children)
+			n_buildings += c->get_component<cCity>()->buildings->children.size();
+	}
+	printf("headless: %u frames, %.1fs simulated, %.3fs wall (%.1fx), %d cities, %d buildings, %d units, %d bullets\n",
+		frames, frames * fixed_step, wall_time, wall_time > 0.f ? frames * fixed_step / wall_time : 0.f,
+		n_cities, n_buildings, (int)unit_store.size(), (int)bullet_pool.actives.size());
+	printf("city yields: %u recomputes in %u frames\n", yield_recomputes, frames);
+	printf("bullet pool: %u allocated, %u reused, %u high water mark\n",
+		bullet_pool.allocated, bullet_pool.reused, bullet_pool.high_water_mark);
+}
+
+float percentile(std::vector<float> samples, float p)
+{
+	if (samples.empty())
+		return 0.f;
+	std::sort(samples.begin(), samples.end());
+	return samples[min(samples.size() - 1, size_t(p * samples.size()))];
+}
+
+void Game::run_benchmark(uint frames, const std::string& out_path)
+{
+	profiling = true;
+	auto wall_time = step_headless(frames);
+
+	auto& sc = *benchmark_scenario;
+	auto json = std::format("{{\"scenario\": \"{}\", \"players\": {}, \"units\": {}, \"cities_per_player\": {}, \"fill_barracks\": {}, "
+		"\"frames\": {}, \"step\": {}, \"seed\": {}, \"wall_time\": {:.3f}, \"time_to_first_frame_ms\": {:.1f}, \"units_alive\": {}, \"yield_recomputes\": {}, \"phases_ms\": {{",
+		sc.name, sc.players, sc.units, sc.cities_per_player, sc.fill_barracks, frames, fixed_step, game_seed, wall_time, time_to_first_frame, unit_store.size(), yield_recomputes);
+	for (auto i = 0; i <= PhaseCount; i++)
+	{
+		auto& samples = phase_samples[i];
+		json += std::format("{}\"{}\": {{\"p50\": {:.4f}, \"p99\": {:.4f}}}", i > 0 ? ", " : "",
+			i < PhaseCount ? phase_names[i] : "frame", percentile(samples, 0.5f) * 1000.f, percentile(samples, 0.99f) * 1000.f);
+	}
+	json += "}}";
+
+	if (out_path.empty())
+		printf("%s\n", json.c_str());
+	else
+	{
+		std::ofstream file(out_path);
+		file << json;
+	}
+}
+
+// every scenario runs in its own process so that each one starts from a fresh world
+int run_benchmark_suite(const char* exe, uint frames, uint seed, const std::string& out_path)
+{
+	std::string json = "[\n";
+	for (auto i = 0; i < count_of(benchmark_scenarios); i++)
+	{
+		auto& sc = benchmark_scenarios[i];
+		auto tmp_path = std::format("benchmark_{}.json", sc.name);
+		auto cmd = std::format("\"\"{}\" -benchmark={} -frames={} -seed={} -benchmark_out={}\"", exe, sc.name, frames, seed, tmp_path);
+		if (std::system(cmd.c_str()) != 0)
+		{
+			printf("benchmark scenario %s failed\n", sc.name);
+			return 1;
+		}
+		std::ifstream file(tmp_path);
+		std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+		std::filesystem::remove(tmp_path);
+		json += "\t" + content + (i + 1 < count_of(benchmark_scenarios) ? ",\n" : "\n");
+	}
+	json += "]\n";
+
+	if (out_path.empty())
+		printf("%s", json.c_str());
+	else
+	{
+		std::ofstream file(out_path);
+		file << json;
+	}
+	return 0;
+}
 
-	scene->set_world2d_contact_listener(on_contact);
+// dead entities are moved behind the live ones in one pass and then popped off the back,
+// so a frame with many deaths costs O(n) instead of one vector shift per removal
+// this relies on the engine's Entity invariants: 'index' is the entity's position in parent->children, and
+// remove_from_parent() erases children[index] and only renumbers the children after it, so removing the last
+// child is O(1). the partition reorders the vector behind the engine's back, hence the indices are rewritten
+// before any removal
+template<typename F>
+uint remove_children_if(EntityPtr parent, bool keep_order, const F& pred)
+{
+	auto& children = parent->children;
+	auto alive = [&](const auto& c) {
+		return !pred(c.get());
+	};
+	auto it = keep_order ? std::stable_partition(children.begin(), children.end(), alive) :
+		std::partition(children.begin(), children.end(), alive);
+	auto n = uint(children.end() - it);
+	if (n == 0)
+		return 0;
+	for (auto i = 0; i < children.size(); i++)
+		children[i]->index = i;
+	for (auto i = 0; i < n; i++)
+		children.back()->remove_from_parent();
+	return n;
+}
+
+void flush_destroyed()
+{
+	auto n_dead_units = 0;
+	for (int i = unit_store.size() - 1; i >= 0; i--)
+	{
+		if (unit_store.dead[i])
+		{
+			unit_store.proxies[i]->dead = true;
+			unit_store.remove(i);
+			n_dead_units++;
+		}
+	}
+	if (n_dead_units > 0)
+	{
+		remove_children_if(e_units_root, false, [](EntityPtr e) {
+			return e->get_component<cUnit>()->dead;
+		});
+	}
 
-	auto rt = renderer->add_render_target(RenderMode2D, camera, main_window, {}, graphics::ImageLayoutPresent);
-	//rt->canvas->enable_clipping = true; // slower..
+	for (auto& p : e_players_root->children)
+	{
+		auto player = p->get_component<cPlayer>();
+		for (auto& c : player->cities->children)
+		{
+			auto city = c->get_component<cCity>();
+			auto n_dead_buildings = 0;
+			for (auto& e : city->buildings->children)
+			{
+				auto b = e->get_base_component<cBuilding>();
+				if (b->dead)
+				{
+					if (b->tile->building == b)
+						b->tile->building = nullptr;
+					mark_yields_dirty(b->tile);
+					n_dead_buildings++;
+				}
+			}
+			if (n_dead_buildings > 0)
+			{
+				std::erase_if(city->scheduler.order, [](cBuilding* b) {
+					return b->dead;
+				});
+				remove_children_if(city->buildings, true, [](EntityPtr e) {
+					return e->get_base_component<cBuilding>()->dead;
+				});
+			}
+		}
+	}
 }
 
 bool Game::on_update()
 {
+	// the first frame has been rendered and presented once the second update begins
+	if (!headless && time_to_first_frame == 0.f && sim_frame == 1)
+	{
+		time_to_first_frame = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - init_begin_time).count();
+		printf("time to first frame: %.1f ms\n", time_to_first_frame);
+	}
+
+	if (replaying || replay_out.is_open())
+		delta_time = fixed_step;
+
+	execute_commands();
+
 	for (auto& p : e_players_root->children)
 	{
+		PhaseScope scope(PhaseAI);
 		auto player = p->get_component<cPlayer>();
 		if (player->ai)
 		{
@@ -1957,7 +3959,7 @@ bool Game::on_update()
 							}
 							if (!cands.empty())
 							{
-								auto type = random_item(cands);
+								auto type = rng_ai.item(cands);
 								auto construction = (cConstruction*)player->add_building(city, BuildingConstruction, tile);
 								construction->construct_building = type;
 								break;
@@ -1972,12 +3974,16 @@ bool Game::on_update()
 	if (hovering_tile)
 	{
 		tile_hover->entity->set_enable(true);
-		tile_hover->set_pos(hovering_tile->element->pos);
+		tile_hover->set_pos(hovering_tile->pos);
 	}
 	else
 		tile_hover->entity->set_enable(false);
 
-	UniverseApplication::on_update();
+	// the world runs the physics step and the player, city and building updates (which time themselves as economy)
+	if (headless)
+		world->update();
+	else
+		UniverseApplication::on_update();
 
 	round_timer -= delta_time;
 	sig_round = false;
@@ -2004,68 +4010,51 @@ bool Game::on_update()
 	}
 
 	{
-		auto n = e_units_root->children.size();
-		for (auto i = 0; i < n; i++)
-		{
-			auto e = e_units_root->children[i].get();
-			auto c = e->get_component<cUnit>();
-			if (c->dead)
-			{
-				e->remove_from_parent();
-				i--;
-				n--;
-			}
-		}
+		PhaseScope scope(PhaseUnits);
+		unit_store.gather();
+		unit_grid.build(e_players_root->children.size());
+		unit_store.update();
 	}
 	{
-		auto n = e_bullets_root->children.size();
-		for (auto i = 0; i < n; i++)
-		{
-			auto e = e_bullets_root->children[i].get();
-			auto b = e->get_component<cBullet>();
-			if (b->dead)
-			{
-				e->remove_from_parent();
-				i--;
-				n--;
-			}
-		}
+		PhaseScope scope(PhaseBullets);
+		update_bullets();
 	}
+	resolve_contacts();
+
+	for (int i = bullet_pool.actives.size() - 1; i >= 0; i--)
 	{
-		for (auto& p : e_players_root->children)
-		{
-			auto player = p->get_component<cPlayer>();
-			for (auto& c : player->cities->children)
-			{
-				auto city = c->get_component<cCity>();
-				auto& buildings = city->buildings->children;
-				auto n = buildings.size();
-				for (auto i = 0; i < n; i++)
-				{
-					auto b = buildings[i]->get_base_component<cBuilding>();
-					if (b->low_priority)
-					{
-						std::rotate(buildings.begin() + i, buildings.begin() + i + 1, buildings.end());
-						b->low_priority = false;
-						i--;
-					}
-				}
-				for (auto i = 0; i < n; i++)
-				{
-					auto e = buildings[i].get();
-					auto b = e->get_base_component<cBuilding>();
-					if (b->dead)
-					{
-						b->tile->building = nullptr;
-						e->remove_from_parent();
-						i--;
-						n--;
-					}
-				}
-			}
-		}
+		auto b = bullet_pool.actives[i];
+		if (b->dead)
+			bullet_pool.release(b);
+	}
+	flush_destroyed();
+
+	sim_frame++;
+
+	if (state_hash_every && sim_frame % state_hash_every == 0)
+		printf("frame %u: state %016llx\n", sim_frame, (unsigned long long)sim_state_hash());
+
+	// headless has nothing to present, its first frame is the first simulated step
+	if (headless && time_to_first_frame == 0.f)
+	{
+		time_to_first_frame = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - init_begin_time).count();
+		if (!profiling) // the benchmark reports it in its json
+			printf("time to first frame: %.1f ms\n", time_to_first_frame);
+	}
+
+	if (headless)
+		return true;
+
+	update_tile_highlights();
+
+	{
+		vec2 lt, rb;
+		camera_view_rect(lt, rb, tile_sz);
+		audio_mixer.flush(total_time, lt, rb);
 	}
 
+	hovering_tile = mouse_over_tiles ? pick_tile(input->mpos) : nullptr;
+
 	if (input->mbtn[Mouse_Middle])
 		camera->element->add_pos(-input->mdisp);
 
@@ -2098,11 +4087,18 @@ bool Game::on_update()
 	return true;
 }
 
-std::wstring format_time(int sec)
+// the strings are kept per second value, so a countdown shown every frame is formatted once per second
+const std::wstring& format_time(int sec)
 {
+	static const std::wstring none = L"--:--";
+	static std::unordered_map<int, std::wstring> texts;
 	if (sec <= 0)
-		return L"--:--";
-	return std::format(L"{:02d}:{:02d}", sec / 60, sec % 60);
+		return none;
+	if (auto it = texts.find(sec); it != texts.end())
+		return it->second;
+	if (texts.size() > 4096)
+		texts.clear();
+	return texts.emplace(sec, std::format(L"{:02d}:{:02d}", sec / 60, sec % 60)).first->second;
 }
 
 void Game::on_hud()
@@ -2117,7 +4113,7 @@ void Game::on_hud()
 	//hud->text(std::format(L"{}", main_player->water_element));
 	//hud->rect(vec2(16.f), cvec4(127, 255, 127, 255));
 	//hud->text(std::format(L"{}", main_player->grass_element));
-	hud->text(std::format(L"{}{}", ch_icon_science, main_player->science));
+	hud->text(hud_texts.get(nullptr, L"{}{}", ch_icon_science, main_player->science));
 	hud->end_layout();
 	hud->end();
 
@@ -2128,16 +4124,36 @@ void Game::on_hud()
 	hud->end();
 
 	hud->begin("round"_h, vec2(screen_size.x * 0.5f, 0.f), vec2(0.f), vec2(0.5f, 0.f));
-	hud->text(std::format(L"{}", (int)round_timer));
+	hud->text(hud_texts.get(nullptr, L"{}", (int)round_timer));
 	hud->end();
 
 	std::wstring popup_str = L"";
 	graphics::ImagePtr popup_img = nullptr;
 
 	hud->begin("cheat"_h, vec2(0.f, screen_size.y), vec2(0.f), vec2(0.f, 1.f));
-	hud->checkbox(&mass_production, L"Mass Production");
+	auto cheat_mass_production = mass_production;
+	hud->checkbox(&cheat_mass_production, L"Mass Production");
+	if (cheat_mass_production != mass_production)
+	{
+		Command c;
+		c.type = CommandSetMassProduction;
+		c.player = main_player->id;
+		c.value = cheat_mass_production ? 1 : 0;
+		issue_command(c);
+	}
 	hud->end();
 
+	// developer counters, only with -profiling
+	if (profiling)
+	{
+		hud->begin("stats"_h, vec2(screen_size.x, 32.f), vec2(0.f), vec2(1.f, 0.f));
+		hud->text(hud_texts.get(&bar_overlay, L"Bars: {} drawn, {} off view", bar_overlay.drawn, bar_overlay.culled));
+		hud->text(hud_texts.get(&hud_texts, L"Hud texts: {} formatted, {} cached", hud_texts.formatted, (uint)hud_texts.entries.size()));
+		hud->text(hud_texts.get(&audio_mixer, L"Sounds: {} events, {} played, {} merged, {} over voices, {} off view",
+			audio_mixer.events, audio_mixer.played, audio_mixer.merged, audio_mixer.over_voices, audio_mixer.culled));
+		hud->end();
+	}
+
 	hud->push_style_color(HudStyleColorWindowBackground, cvec4(0, 0, 0, 0));
 	hud->push_style_var(HudStyleVarWindowFrame, vec4(0.f));
 	hud->begin("tips"_h, vec2(screen_size.x, screen_size.y - 220.f), vec2(0.f), vec2(1.f));
@@ -2182,23 +4198,23 @@ void Game::on_hud()
 
 				hud->push_style_color(HudStyleColorText, cvec4(0, 0, 0, 255));
 				hud->progress_bar(vec2(200.f, 24.f), (float)owner_city->hp / (float)owner_city->hp_max,
-					cvec4(127, 255, 127, 255), cvec4(127, 127, 127, 255), std::format(L"{}/{}", int(owner_city->hp / 100), int(owner_city->hp_max / 100)));
+					cvec4(127, 255, 127, 255), cvec4(127, 127, 127, 255), hud_texts.get(owner_city, L"{}/{}", int(owner_city->hp / 100), int(owner_city->hp_max / 100)));
 				hud->pop_style_color(HudStyleColorText);
 
 				hud->begin_layout(HudHorizontal);
-				hud->text(std::format(L"{}{}{}{}", owner_city->population, ch_color_white, ch_icon_population, ch_color_end));
+				hud->text(hud_texts.get(&owner_city->population, L"{}{}{}{}", owner_city->population, ch_color_white, ch_icon_population, ch_color_end));
 				if (hud->item_hovered())
 				{
-					popup_str = std::format(
+					popup_str = hud_texts.get(owner_city,
 						L"Total Population: {}\n"
 						L"Unapplied  Population: {}", 
 						owner_city->population,
 						owner_city->free_population);
 				}
-				hud->text(std::format(L"{}{}{}{}", owner_city->food_production, ch_color_white, ch_icon_food, ch_color_end));
+				hud->text(hud_texts.get(&owner_city->food_production, L"{}{}{}{}", owner_city->food_production, ch_color_white, ch_icon_food, ch_color_end));
 				if (hud->item_hovered())
 				{
-					popup_str = std::format(
+					popup_str = hud_texts.get(owner_city,
 						L"Food Produced: +{}\n"
 						L"Food Consumption: -{}\n"
 						L"Food Surplus: {}",
@@ -2207,10 +4223,10 @@ void Game::on_hud()
 						owner_city->food_production
 					);
 				}
-				hud->text(std::format(L"{}{}{}{}", owner_city->production, ch_color_white, ch_icon_production, ch_color_end));
+				hud->text(hud_texts.get(&owner_city->production, L"{}{}{}{}", owner_city->production, ch_color_white, ch_icon_production, ch_color_end));
 				if (hud->item_hovered())
 				{
-					popup_str = std::format(
+					popup_str = hud_texts.get(owner_city,
 						L"Production Produced: {}",
 						owner_city->production
 					);
@@ -2218,12 +4234,12 @@ void Game::on_hud()
 				hud->end_layout();
 
 				hud->begin_layout(HudHorizontal);
-				hud->text(std::format(L"{}{}{}", ch_color_white, ch_icon_population, ch_color_end));
+				hud->text(hud_texts.get(owner_city, L"{}{}{}", ch_color_white, ch_icon_population, ch_color_end));
 				if (hud->item_hovered())
-					popup_str = std::format(L"Population Growth\nNeeded Surplus Food: {}\nStored Surplus Food: {:.1f}", owner_city->food_to_produce_population / 100, owner_city->surplus_food / 100.f);
+					popup_str = hud_texts.get(owner_city, L"Population Growth\nNeeded Surplus Food: {}\nStored Surplus Food: {:.1f}", owner_city->food_to_produce_population / 100, owner_city->surplus_food / 100.f);
 				hud->push_style_color(HudStyleColorText, cvec4(0, 0, 0, 255));
 				hud->progress_bar(vec2(178.f, 24.f), (float)owner_city->surplus_food / (float)owner_city->food_to_produce_population,
-					cvec4(255, 200, 127, 255), cvec4(127, 127, 127, 255), std::format(L"{:.1f}/{}{}{}{}    {}", 
+					cvec4(255, 200, 127, 255), cvec4(127, 127, 127, 255), hud_texts.get(owner_city, L"{:.1f}/{}{}{}{}    {}", 
 						owner_city->surplus_food / 100.f, owner_city->food_to_produce_population / 100,
 						ch_color_white, ch_icon_food, ch_color_end,
 						format_time((owner_city->food_to_produce_population - owner_city->surplus_food) / (owner_city->food_production * 60))));
@@ -2238,31 +4254,20 @@ void Game::on_hud()
 				if (hud->button(L"New City"))
 				{
 					auto cands = get_nearby_tiles(owner_city->tile, 3);
-					begin_select_tile([&cands](cTile* tile) {
-						if (main_player->has_territory(tile))
-							return false;
-						for (auto c : cands)
-						{
-							if (c == tile)
-								return true;
-						}
-						return false;
-					}, [owner_city, cands](cTile* tile) {
+					begin_select_tile(cands, [](Tile* tile) {
+						return !main_player->has_territory(tile);
+					}, [owner_city](Tile* tile) {
 						if (main_player->has_territory(tile))
 							return;
-						auto ok = false;
-						for (auto c : cands)
-						{
-							if (c == tile)
-							{
-								ok = true;
-								break;
-							}
-						}
-						if (ok)
+						if (tile_distance(tile, owner_city->tile) <= 3)
 						{
-							auto construction = (cConstruction*)main_player->add_building(owner_city, BuildingConstruction, tile);
-							construction->construct_building = BuildingCity;
+							Command c;
+							c.type = CommandConstruct;
+							c.player = main_player->id;
+							c.value = BuildingCity;
+							c.tile = tile->id;
+							c.city_tile = owner_city->tile->id;
+							issue_command(c);
 						}
 					});
 				}
@@ -2274,12 +4279,12 @@ void Game::on_hud()
 			{
 				hud->push_style_color(HudStyleColorText, building->player->color);
 				hud->text(building->type == BuildingConstruction ? 
-					std::format(L"Construction: {}", building_infos[((cConstruction*)building)->construct_building].name) : info.name);
+					hud_texts.get(building, L"Construction: {}", building_infos[((cConstruction*)building)->construct_building].name) : info.name);
 				hud->pop_style_color(HudStyleColorText);
 
 				hud->push_style_color(HudStyleColorText, cvec4(0, 0, 0, 255));
 				hud->progress_bar(vec2(200.f, 24.f), (float)building->hp / (float)building->hp_max,
-					owner_city->player->color, cvec4(127, 127, 127, 255), std::format(L"{}/{}", int(building->hp / 100), int(building->hp_max / 100)));
+					owner_city->player->color, cvec4(127, 127, 127, 255), hud_texts.get(building, L"{}/{}", int(building->hp / 100), int(building->hp_max / 100)));
 				hud->pop_style_color(HudStyleColorText);
 
 				if (owner_city && owner_city->player == main_player)
@@ -2290,12 +4295,26 @@ void Game::on_hud()
 					if (building->building_enable)
 					{
 						if (hud->button(L"Disable"))
-							building->set_building_enable(false);
+						{
+							Command c;
+							c.type = CommandSetBuildingEnable;
+							c.player = main_player->id;
+							c.value = 0;
+							c.tile = building->tile->id;
+							issue_command(c);
+						}
 					}
 					else
 					{
 						if (hud->button(L"Enable"))
-							building->set_building_enable(true);
+						{
+							Command c;
+							c.type = CommandSetBuildingEnable;
+							c.player = main_player->id;
+							c.value = 1;
+							c.tile = building->tile->id;
+							issue_command(c);
+						}
 					}
 					hud->pop_style_image(HudStyleImageButton, 4);
 					hud->end_layout();
@@ -2305,8 +4324,8 @@ void Game::on_hud()
 						graphics::ImagePtr icon = nullptr;
 						switch (p.type)
 						{
-						case ProductionBuilding: icon = building_infos[p.item_id].image; break;
-						case ProductionUnit: icon = unit_infos[p.item_id].image;  break;
+						case ProductionBuilding: icon = building_infos[p.item_id].image.get(); break;
+						case ProductionUnit: icon = unit_infos[p.item_id].image.get();  break;
 						}
 						hud->begin_layout(HudHorizontal);
 						hud->image(vec2(32.f), icon->desc());
@@ -2318,7 +4337,7 @@ void Game::on_hud()
 							case ProductionBuilding:
 							{
 								auto& info = building_infos[p.item_id];
-								popup_str = std::format(
+								popup_str = hud_texts.get(&p,
 									L"{}{}{}\n"
 									L"{}{}{}",
 									ch_size_big, info.name, ch_size_end,
@@ -2328,7 +4347,7 @@ void Game::on_hud()
 							case ProductionUnit:
 							{
 								auto& info = unit_infos[p.item_id];
-								popup_str = std::format(
+								popup_str = hud_texts.get(&p,
 									L"{}{}{}\n"
 									L"{}{}{}",
 									ch_size_big, info.name, ch_size_end,
@@ -2339,7 +4358,7 @@ void Game::on_hud()
 						}
 						hud->push_style_color(HudStyleColorText, cvec4(0, 0, 0, 255));
 						hud->progress_bar(vec2(200.f, 24.f), (float)p.value / (float)p.need_value,
-							owner_city->player->color, cvec4(127, 127, 127, 255), std::format(
+							owner_city->player->color, cvec4(127, 127, 127, 255), hud_texts.get(&p,
 								L"{:.1f}/{}{}{}{}    {}",
 								p.value / 100.f, p.need_value / 100, ch_color_white, ch_icon_production, ch_color_end,
 								format_time(p.value_avg > 0 ? (p.need_value - p.value) / p.value_avg : 0)));
@@ -2353,8 +4372,8 @@ void Game::on_hud()
 						{
 							hud->begin_layout(HudHorizontal);
 							auto& info = unit_infos[ru.first];
-							hud->image(vec2(32.f), info.image->desc());
-							hud->text(std::format(L" x{}", ru.second));
+							hud->image(vec2(32.f), info.image.get()->desc());
+							hud->text(hud_texts.get(&ru, L" x{}", ru.second));
 							hud->end_layout();
 						}
 					}
@@ -2368,9 +4387,9 @@ void Game::on_hud()
 			hud->begin_layout(HudVertical);
 			switch (selecting_tile->element_type)
 			{
-			case ElementFire: hud->text(std::format(L"{}{}{}Fire Tile  ", ch_color_elements[ElementFire], ch_icon_tile, ch_color_end)); break;
-			case ElementWater: hud->text(std::format(L"{}{}{}Water Tile  ", ch_color_elements[ElementWater], ch_icon_tile, ch_color_end)); break;
-			case ElementGrass: hud->text(std::format(L"{}{}{}Grass Tile  ", ch_color_elements[ElementGrass], ch_icon_tile, ch_color_end)); break;
+			case ElementFire: hud->text(hud_texts.get(selecting_tile, L"{}{}{}Fire Tile  ", ch_color_elements[ElementFire], ch_icon_tile, ch_color_end)); break;
+			case ElementWater: hud->text(hud_texts.get(selecting_tile, L"{}{}{}Water Tile  ", ch_color_elements[ElementWater], ch_icon_tile, ch_color_end)); break;
+			case ElementGrass: hud->text(hud_texts.get(selecting_tile, L"{}{}{}Grass Tile  ", ch_color_elements[ElementGrass], ch_icon_tile, ch_color_end)); break;
 			}
 
 			if (owner_city && owner_city->player == main_player)
@@ -2388,8 +4407,13 @@ void Game::on_hud()
 					hud->push_style_color(HudStyleColorTextDisabled, cvec4(180, 180, 180, 255));
 					if (hud->button(info.name, "construction"_h + (int)info.name.c_str()))
 					{
-						auto construction = (cConstruction*)main_player->add_building(owner_city, BuildingConstruction, selecting_tile);
-						construction->construct_building = type;
+						Command c;
+						c.type = CommandConstruct;
+						c.player = main_player->id;
+						c.value = type;
+						c.tile = selecting_tile->id;
+						c.city_tile = owner_city->tile->id;
+						issue_command(c);
 					}
 					hud->pop_style_color(HudStyleColorText);
 					hud->pop_style_color(HudStyleColorTextDisabled);
@@ -2397,8 +4421,8 @@ void Game::on_hud()
 						hud->pop_enable();
 					if (hud->item_hovered())
 					{
-						popup_img = info.image;
-						popup_str = std::format(
+						popup_img = info.image.get();
+						popup_str = hud_texts.get(&info,
 							L"{}{}{}\n"
 							L"Need: {}{}{}{}    {}\n"
 							L"{}{}{}",
@@ -2406,7 +4430,7 @@ void Game::on_hud()
 							info.need_production / 100, ch_color_white, ch_icon_production, ch_color_end, format_time(info.need_production / (owner_city->production * 60)),
 							ch_size_medium, info.description, ch_size_end);
 						if (!ok)
-							popup_str += std::format(L"\n{}Can Only Build On {} Tile{}", ch_color_no, get_element_name(info.require_tile_type), ch_color_end);
+							popup_str += hud_texts.get(&info, L"\n{}Can Only Build On {} Tile{}", ch_color_no, get_element_name(info.require_tile_type), ch_color_end);
 					}
 				}
 			}
@@ -2423,7 +4447,7 @@ void Game::on_hud()
 		//hud->pop_style_color(HudStyleColorText);
 
 		tile_select->entity->set_enable(true);
-		tile_select->set_pos(selecting_tile->element->pos);
+		tile_select->set_pos(selecting_tile->pos);
 	}
 	else
 		tile_select->entity->set_enable(false);
@@ -2432,48 +4456,53 @@ void Game::on_hud()
 	{
 		hud->begin("tech_tree"_h, vec2(20.f, 75.f), vec2(1240.f, 600.f));
 		hud->begin_layout(HudVertical, vec2(1236.f, 560.f));
-		std::function<void(Technology*)> show_tech_ui;
-		show_tech_ui = [&](Technology* tech) {
+		std::function<void(uint)> show_tech_ui;
+		show_tech_ui = [&](uint idx) {
 			hud->begin_layout(HudHorizontal);
-			for (auto t : tech->children)
+			for (auto i : tech_infos[idx].children)
 			{
+				auto& info = tech_infos[i];
+				auto& t = main_player->techs[i];
 				hud->begin_layout(HudVertical);
 				hud->push_style_var(HudStyleVarFrame, vec4(1.f));
-				hud->push_style_color(HudStyleColorFrame, t->completed ? cvec4(255) : (t->researching ? cvec4(127, 127, 255, 255) : cvec4(127, 127, 127, 255)));
-				hud->push_style_color(HudStyleColorImage, t->completed ? cvec4(255) : cvec4(127, 127, 127, 255));
-				hud->image(vec2(32.f), t->image->desc());
+				hud->push_style_color(HudStyleColorFrame, t.completed ? cvec4(255) : (t.researching ? cvec4(127, 127, 255, 255) : cvec4(127, 127, 127, 255)));
+				hud->push_style_color(HudStyleColorImage, t.completed ? cvec4(255) : cvec4(127, 127, 127, 255));
+				hud->image(vec2(32.f), info.image.get()->desc());
 				hud->pop_style_var(HudStyleVarFrame);
 				hud->pop_style_color(HudStyleColorFrame);
 				hud->pop_style_color(HudStyleColorImage);
 				if (hud->item_hovered())
 				{
-					popup_str = std::format(
+					popup_str = hud_texts.get(&t,
 						L"{}{}{}\n"
 						L"Progress: {:.1f}/{}{}{}{}    {}\n"
 						L"{}{}{}",
-						ch_size_big, t->name, ch_size_end,
-						t->value / 100.f, t->need_value / 100, ch_color_white, ch_icon_science, ch_color_end,
-						format_time(t->researching && t->value_avg > 0 ? (t->need_value - t->value) / t->value_avg : 0),
-						ch_size_medium, t->description, ch_size_end);
+						ch_size_big, info.name, ch_size_end,
+						t.value / 100.f, info.need_value / 100, ch_color_white, ch_icon_science, ch_color_end,
+						format_time(t.researching && t.value_avg > 0 ? (info.need_value - t.value) / t.value_avg : 0),
+						ch_size_medium, info.description, ch_size_end);
 				}
 				if (hud->item_clicked())
 				{
-					main_player->tech_tree->stop_researching();
-					t->start_researching();
+					Command c;
+					c.type = CommandResearch;
+					c.player = main_player->id;
+					c.value = i;
+					issue_command(c);
 				}
-				if (!t->completed)
+				if (!t.completed)
 				{
-					hud->progress_bar(vec2(32.f, 4.f), (float)t->value / (float)t->need_value,
+					hud->progress_bar(vec2(32.f, 4.f), (float)t.value / (float)info.need_value,
 						cvec4(127, 127, 255, 255), cvec4(127, 127, 127, 255), L"");
 				}
 				hud->end_layout();
 			}
 			hud->end_layout();
 
-			for (auto t : tech->children)
-				show_tech_ui(t);
+			for (auto i : tech_infos[idx].children)
+				show_tech_ui(i);
 		};
-		show_tech_ui(main_player->tech_tree);
+		show_tech_ui(0);
 		hud->end_layout();
 
 		hud->begin_layout(HudHorizontal);
@@ -2515,8 +4544,90 @@ Game game;
 
 int entry(int argc, char** args)
 {
+	auto frames = 60U * 60U * 10U;
+	auto seed = (uint)time(0);
+	std::string record_path;
+	std::string replay_path;
+	auto benchmark_suite = false;
+	auto n_threads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0U;
+	std::string benchmark_out;
+	for (auto i = 1; i < argc; i++)
+	{
+		std::string_view arg(args[i]);
+		if (arg == "-headless")
+			headless = true;
+		else if (arg.starts_with("-frames="))
+			frames = std::stoul(std::string(arg.substr(8)));
+		else if (arg.starts_with("-step="))
+			fixed_step = std::stof(std::string(arg.substr(6)));
+		else if (arg.starts_with("-bullet_pool="))
+			bullet_pool.reserve_per_player = std::stoul(std::string(arg.substr(13)));
+		else if (arg.starts_with("-seed="))
+			seed = std::stoul(std::string(arg.substr(6)));
+		else if (arg.starts_with("-record="))
+			record_path = arg.substr(8);
+		else if (arg.starts_with("-replay="))
+			replay_path = arg.substr(8);
+		else if (arg == "-benchmark")
+			benchmark_suite = true;
+		else if (arg.starts_with("-benchmark="))
+		{
+			auto name = arg.substr(11);
+			for (auto& sc : benchmark_scenarios)
+			{
+				if (name == sc.name)
+					benchmark_scenario = &sc;
+			}
+			if (!benchmark_scenario)
+			{
+				printf("unknown benchmark scenario: %s\n", std::string(name).c_str());
+				return 1;
+			}
+			headless = true;
+		}
+		else if (arg.starts_with("-benchmark_out="))
+			benchmark_out = arg.substr(15);
+		else if (arg == "-profiling")
+			profiling = true;
+		else if (arg.starts_with("-state_hash="))
+			state_hash_every = std::stoul(std::string(arg.substr(12)));
+		else if (arg.starts_with("-threads="))
+		{
+			auto n = (uint)std::stoul(std::string(arg.substr(9)));
+			n_threads = n > 1 ? n - 1 : 0;
+		}
+	}
+
+	if (benchmark_suite)
+		return run_benchmark_suite(args[0], frames, seed, benchmark_out);
+
+	seed_game(seed);
+	main_player_ai = headless;
+	worker_pool.init(n_threads);
+	if (!replay_path.empty())
+	{
+		if (!load_replay(replay_path))
+		{
+			printf("cannot load replay: %s\n", replay_path.c_str());
+			return 1;
+		}
+	}
+	else if (!record_path.empty())
+	{
+		if (!begin_record(record_path))
+		{
+			printf("cannot write replay: %s\n", record_path.c_str());
+			return 1;
+		}
+	}
+
 	game.init();
-	game.run();
+	if (benchmark_scenario)
+		game.run_benchmark(frames, benchmark_out);
+	else if (headless)
+		game.run_headless(frames);
+	else
+		game.run();
 
 	return 0;
 }